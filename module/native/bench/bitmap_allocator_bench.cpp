@@ -0,0 +1,96 @@
+// Benchmarks for the COW chunk bitmap: allocation cost per chunk and per
+// contiguous run as the device fills, for a packed (front-filled) and a
+// fragmented layout.
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "bitmap_allocator.h"
+
+namespace {
+
+constexpr uint64_t device_chunks = uint64_t(1) << 22;
+constexpr size_t round_chunks = 4096; // Allocations between untimed releases
+constexpr size_t run_chunks = 256;
+constexpr size_t round_runs = 32;
+
+// Fills `fill` of the device: packed allocates from the front, fragmented
+// fills everything and frees each chunk with probability (1 - fill).
+void prepare(BitmapAllocator& bitmap, double fill, bool fragmented) {
+    std::mt19937_64 rng(42);
+    std::vector<uint64_t> chunks(1 << 16);
+    uint64_t target = fragmented ? device_chunks : static_cast<uint64_t>(device_chunks * fill);
+    while (bitmap.free_count() > device_chunks - target) {
+        size_t want = static_cast<size_t>(std::min<uint64_t>(chunks.size(), target - (device_chunks - bitmap.free_count())));
+        bitmap.allocate(want, chunks.data());
+    }
+    if (fragmented) {
+        std::bernoulli_distribution release(1.0 - fill);
+        for (uint64_t chunk = 0; chunk < device_chunks; ++chunk) {
+            if (release(rng)) {
+                bitmap.release(chunk);
+            }
+        }
+    }
+}
+
+void BM_AllocateChunk(benchmark::State& state) {
+    BitmapAllocator bitmap(device_chunks);
+    prepare(bitmap, state.range(1) / 100.0, state.range(0) != 0);
+
+    std::vector<uint64_t> chunks(round_chunks);
+    size_t got = 0;
+    for (auto _ : state) {
+        uint64_t chunk = bitmap.find_and_set_first_zero();
+        if (chunk == BitmapAllocator::npos) {
+            state.SkipWithError("COW device full");
+            break;
+        }
+        chunks[got++] = chunk;
+        if (got == round_chunks) {
+            // Give the round back so the fill level stays put.
+            state.PauseTiming();
+            bitmap.release(chunks.data(), got);
+            got = 0;
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AllocateChunk)
+    ->ArgNames({"fragmented", "full_pct"})
+    ->ArgsProduct({{0, 1}, {0, 25, 50, 75, 90, 95, 99}});
+
+void BM_AllocateRun(benchmark::State& state) {
+    BitmapAllocator bitmap(device_chunks);
+    prepare(bitmap, state.range(0) / 100.0, false);
+
+    std::vector<uint64_t> runs(round_runs);
+    size_t got = 0;
+    for (auto _ : state) {
+        uint64_t first = bitmap.allocate_contiguous(run_chunks);
+        if (first == BitmapAllocator::npos) {
+            state.SkipWithError("No free run");
+            break;
+        }
+        runs[got++] = first;
+        if (got == round_runs) {
+            state.PauseTiming();
+            for (uint64_t run : runs) {
+                bitmap.release_contiguous(run, run_chunks);
+            }
+            got = 0;
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AllocateRun)
+    ->ArgNames({"full_pct"})
+    ->DenseRange(0, 90, 30)
+    ->Arg(99);
+
+} // namespace
@@ -0,0 +1,66 @@
+// Benchmarks for COW chunk allocation through ChunkAllocator's per-CPU
+// caches, by request size and thread count, on an empty and a 90% full
+// device.
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "chunk_allocator.h"
+
+namespace {
+
+constexpr uint64_t device_chunks = uint64_t(1) << 22;
+constexpr size_t in_flight = 32; // Requests a thread holds before freeing the oldest
+
+// Shared by the threads of one BM_AllocateChunks run.
+std::unique_ptr<ChunkAllocator> shared_allocator;
+
+// Takes `fill` of the device in requests large enough to bypass the caches.
+void allocate_chunks_setup(const benchmark::State& state) {
+    shared_allocator = std::make_unique<ChunkAllocator>(device_chunks);
+    uint64_t target = static_cast<uint64_t>(device_chunks * (state.range(1) / 100.0));
+    std::vector<uint64_t> chunks(1 << 16);
+    for (uint64_t taken = 0; taken < target;) {
+        taken += shared_allocator->allocate_chunks(
+            static_cast<size_t>(std::min<uint64_t>(chunks.size(), target - taken)), chunks.data());
+    }
+}
+
+void allocate_chunks_teardown(const benchmark::State&) {
+    shared_allocator.reset();
+}
+
+// Each thread allocates `chunks` per request and frees its oldest request
+// once `in_flight` are held, so both sides go through its CPU's cache the
+// way COW faults and merges do. Requests of a full cache batch (64) or
+// more bypass the cache.
+void BM_AllocateChunks(benchmark::State& state) {
+    size_t request = static_cast<size_t>(state.range(0));
+    std::vector<uint64_t> held(in_flight * request);
+    size_t i = 0;
+    for (auto _ : state) {
+        uint64_t* slot = held.data() + (i % in_flight) * request;
+        if (i >= in_flight) {
+            shared_allocator->free_chunks(slot, request);
+        }
+        if (shared_allocator->allocate_chunks(request, slot) < request) {
+            state.SkipWithError("COW device full");
+            break;
+        }
+        ++i;
+    }
+    shared_allocator->free_chunks(held.data(), std::min(i, in_flight) * request);
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(request));
+}
+BENCHMARK(BM_AllocateChunks)
+    ->ArgNames({"chunks", "full_pct"})
+    ->ArgsProduct({{1, 8, 64}, {0, 90}})
+    ->ThreadRange(1, 8)
+    ->Setup(allocate_chunks_setup)
+    ->Teardown(allocate_chunks_teardown)
+    ->UseRealTime();
+
+} // namespace
@@ -15,6 +15,16 @@
 #include <linux/ftrace.h>
 #include <linux/kallsyms.h>
 #include <linux/version.h>
+#include <linux/rhashtable.h>
+#include <linux/atomic.h>
+#include <linux/miscdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
+#include <linux/log2.h>
+
+#include "fs_monitor/corestate_ring.h"
 
 #define MODULE_NAME "corestate"
 #define MODULE_VERSION "2.0.0"
@@ -38,7 +48,7 @@ static struct proc_dir_entry *corestate_proc_entry;
 static bool module_active = false;
 static bool cow_enabled = false;
 static bool snapshot_enabled = false;
-static unsigned long monitored_files = 0;
+static atomic_long_t monitored_files = ATOMIC_LONG_INIT(0);
 static unsigned long backup_operations = 0;
 
 // File operations structure
@@ -76,53 +86,293 @@ static DEFINE_SPINLOCK(snapshot_lock);
 static unsigned long next_snapshot_id = 1;
 
 // Copy-on-Write tracking structure
-struct cow_entry {
+struct cow_key {
     unsigned long inode;
     dev_t device;
-    struct timespec64 modified_at;
+};
+
+struct cow_entry {
+    struct cow_key key;
+    ktime_t modified_at;
     bool needs_backup;
-    struct list_head list;
+    struct rhash_head node;
 };
 
-static LIST_HEAD(cow_list);
-static DEFINE_SPINLOCK(cow_lock);
+// Tracked files are indexed by (inode, device) in an rhashtable: lookups
+// are lockless under RCU and inserts only take a per-bucket lock, so the
+// write path costs the same at any number of tracked files. Entries live
+// until module exit.
+static const struct rhashtable_params cow_params = {
+    .key_len = offsetofend(struct cow_key, device), // Excludes tail padding
+    .key_offset = offsetof(struct cow_entry, key),
+    .head_offset = offsetof(struct cow_entry, node),
+    .automatic_shrinking = true,
+};
 
-// Function hooks for file system monitoring
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 7, 0)
-static struct ftrace_ops corestate_ftrace_ops;
+static struct rhashtable cow_table;
+static struct kmem_cache *cow_entry_cache;
+
+// Userspace event rings (layout in fs_monitor/corestate_ring.h). Each CPU
+// appends to its own ring with preemption disabled, so every ring has a
+// single producer and needs no lock; the consumer is woken only when a ring
+// goes from empty to non-empty.
+static unsigned int ring_records = 4096;
+module_param(ring_records, uint, 0444);
+MODULE_PARM_DESC(ring_records, "Write records per CPU ring (rounded up to a power of two)");
+
+static void *ring_area;
+static unsigned int ring_capacity;
+static size_t ring_stride;
+static atomic_t ring_opened = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(ring_waitq);
+static struct eventfd_ctx __rcu *ring_eventfd;
+static DEFINE_MUTEX(ring_eventfd_mutex);
+
+static struct corestate_ring_header *ring_for_cpu(unsigned int cpu) {
+    return ring_area + PAGE_SIZE + cpu * ring_stride;
+}
+
+static struct corestate_ring_record *ring_slot(struct corestate_ring_header *ring, u64 counter) {
+    struct corestate_ring_record *records = (void *)ring + sizeof(*ring);
+    return &records[counter & (ring_capacity - 1)];
+}
+
+static void corestate_ring_signal(void) {
+    struct eventfd_ctx *eventfd;
+    
+    wake_up_interruptible(&ring_waitq);
+    rcu_read_lock();
+    eventfd = rcu_dereference(ring_eventfd);
+    if (eventfd) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+        eventfd_signal(eventfd);
+#else
+        eventfd_signal(eventfd, 1);
 #endif
+    }
+    rcu_read_unlock();
+}
 
-// File system operation monitoring
-static void corestate_file_modified(const char *path, struct inode *inode) {
-    struct cow_entry *entry;
-    unsigned long flags;
+// Caller holds rcu_read_lock(), which keeps the rings alive across module exit.
+static void corestate_ring_push(const struct cow_key *key, loff_t pos, size_t count, unsigned int blkbits) {
+    struct corestate_ring_header *ring;
+    struct corestate_ring_record *record;
+    u64 head, tail;
+    bool was_empty;
+    
+    if (!count) {
+        return;
+    }
     
-    if (!cow_enabled) return;
+    ring = ring_for_cpu(get_cpu());
+    head = ring->head;
+    tail = smp_load_acquire(&ring->tail);
+    if (head - tail >= ring_capacity) {
+        // Full: the consumer notices the counter and rescans
+        WRITE_ONCE(ring->dropped, ring->dropped + 1);
+        put_cpu();
+        return;
+    }
     
-    spin_lock_irqsave(&cow_lock, flags);
+    record = ring_slot(ring, head);
+    record->block = pos >> blkbits;
+    record->inode = key->inode;
+    record->device = new_encode_dev(key->device);
+    record->blocks = (u32)(((pos + count - 1) >> blkbits) - (pos >> blkbits) + 1);
+    record->bytes = (u32)min_t(size_t, count, U32_MAX);
+    record->reserved = 0;
+    smp_store_release(&ring->head, head + 1);
+    
+    // Pairs with the barrier the consumer issues after releasing its tail,
+    // and with the one in corestate_ring_poll(): either the consumer sees
+    // the new head, or we see that it had drained the ring and may be
+    // about to sleep.
+    smp_mb();
+    was_empty = READ_ONCE(ring->tail) == head;
+    put_cpu();
+    
+    if (was_empty) {
+        corestate_ring_signal();
+    }
+}
+
+static void corestate_ring_set_eventfd(struct eventfd_ctx *ctx) {
+    struct eventfd_ctx *old;
+    
+    mutex_lock(&ring_eventfd_mutex);
+    old = rcu_replace_pointer(ring_eventfd, ctx, lockdep_is_held(&ring_eventfd_mutex));
+    mutex_unlock(&ring_eventfd_mutex);
+    if (old) {
+        synchronize_rcu();
+        eventfd_ctx_put(old);
+    }
+}
+
+static int corestate_ring_open(struct inode *inode, struct file *file) {
+    // One consumer per ring keeps them single-consumer
+    if (atomic_cmpxchg(&ring_opened, 0, 1)) {
+        return -EBUSY;
+    }
+    return 0;
+}
+
+static int corestate_ring_release(struct inode *inode, struct file *file) {
+    corestate_ring_set_eventfd(NULL);
+    atomic_set(&ring_opened, 0);
+    return 0;
+}
+
+static int corestate_ring_mmap(struct file *file, struct vm_area_struct *vma) {
+    return remap_vmalloc_range(vma, ring_area, vma->vm_pgoff);
+}
+
+static __poll_t corestate_ring_poll(struct file *file, poll_table *wait) {
+    struct corestate_ring_header *ring;
+    unsigned int cpu;
+    
+    poll_wait(file, &ring_waitq, wait);
+    smp_mb(); // Pairs with corestate_ring_push()
+    for_each_possible_cpu(cpu) {
+        ring = ring_for_cpu(cpu);
+        if (smp_load_acquire(&ring->head) != READ_ONCE(ring->tail)) {
+            return EPOLLIN | EPOLLRDNORM;
+        }
+    }
+    return 0;
+}
+
+static long corestate_ring_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    struct eventfd_ctx *ctx = NULL;
+    int fd;
     
-    // Check if this inode is already being tracked
-    list_for_each_entry(entry, &cow_list, list) {
-        if (entry->inode == inode->i_ino && entry->device == inode->i_sb->s_dev) {
-            ktime_get_real_ts64(&entry->modified_at);
-            entry->needs_backup = true;
-            spin_unlock_irqrestore(&cow_lock, flags);
-            return;
+    if (cmd != CORESTATE_RING_IOC_SET_EVENTFD) {
+        return -ENOTTY;
+    }
+    if (get_user(fd, (int __user *)arg)) {
+        return -EFAULT;
+    }
+    if (fd >= 0) {
+        ctx = eventfd_ctx_fdget(fd);
+        if (IS_ERR(ctx)) {
+            return PTR_ERR(ctx);
         }
     }
+    corestate_ring_set_eventfd(ctx);
+    return 0;
+}
+
+static const struct file_operations corestate_ring_fops = {
+    .owner = THIS_MODULE,
+    .open = corestate_ring_open,
+    .release = corestate_ring_release,
+    .mmap = corestate_ring_mmap,
+    .poll = corestate_ring_poll,
+    .unlocked_ioctl = corestate_ring_ioctl,
+};
+
+static struct miscdevice corestate_ring_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "corestate_ring",
+    .fops = &corestate_ring_fops,
+    .mode = 0600,
+};
+
+static int corestate_ring_init(void) {
+    struct corestate_ring_info *info;
+    size_t total;
+    int ret;
     
-    // Create new COW entry
-    entry = kmalloc(sizeof(*entry), GFP_ATOMIC);
+    ring_capacity = roundup_pow_of_two(clamp_t(unsigned int, ring_records, 64, 1U << 20));
+    ring_stride = PAGE_ALIGN(sizeof(struct corestate_ring_header) +
+                             (size_t)ring_capacity * sizeof(struct corestate_ring_record));
+    total = PAGE_SIZE + nr_cpu_ids * ring_stride;
+    
+    ring_area = vmalloc_user(total); // Zeroed, so every ring starts empty
+    if (!ring_area) {
+        return -ENOMEM;
+    }
+    
+    info = ring_area;
+    info->magic = CORESTATE_RING_MAGIC;
+    info->version = CORESTATE_RING_VERSION;
+    info->ring_count = nr_cpu_ids;
+    info->capacity = ring_capacity;
+    info->ring_offset = PAGE_SIZE;
+    info->ring_stride = ring_stride;
+    info->records_offset = sizeof(struct corestate_ring_header);
+    info->map_bytes = total;
+    
+    ret = misc_register(&corestate_ring_dev);
+    if (ret) {
+        vfree(ring_area);
+        ring_area = NULL;
+    }
+    return ret;
+}
+
+// Runs after writers are quiesced; an open device pins the module, so no
+// mapping can outlive the area.
+static void corestate_ring_exit(void) {
+    misc_deregister(&corestate_ring_dev);
+    vfree(ring_area);
+    ring_area = NULL;
+}
+
+// Function hooks for file system monitoring
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 7, 0)
+static struct ftrace_ops corestate_ftrace_ops;
+#endif
+
+static void cow_entry_touch(struct cow_entry *entry) {
+    WRITE_ONCE(entry->modified_at, ktime_get_real());
+    WRITE_ONCE(entry->needs_backup, true);
+}
+
+// File system operation monitoring (process context): `count` bytes written at `pos`.
+// Nothing calls this yet: no ftrace, kprobe or fsnotify hook is registered, so
+// neither the COW table nor the write rings see any writes until one is.
+static void corestate_file_modified(const char *path, struct inode *inode, loff_t pos, size_t count) {
+    struct cow_key key = { .inode = inode->i_ino, .device = inode->i_sb->s_dev };
+    struct cow_entry *entry, *existing;
+    
+    // The enabled check sits inside the RCU section so module exit's
+    // synchronize_rcu() waits out any writer that saw it set.
+    rcu_read_lock();
+    if (!READ_ONCE(cow_enabled)) {
+        rcu_read_unlock();
+        return;
+    }
+    
+    // Already tracked: refresh it without taking any lock
+    entry = rhashtable_lookup(&cow_table, &key, cow_params);
     if (entry) {
-        entry->inode = inode->i_ino;
-        entry->device = inode->i_sb->s_dev;
-        ktime_get_real_ts64(&entry->modified_at);
-        entry->needs_backup = true;
-        list_add(&entry->list, &cow_list);
-        monitored_files++;
+        cow_entry_touch(entry);
+        goto out;
+    }
+    
+    // Create new COW entry
+    entry = kmem_cache_alloc(cow_entry_cache, GFP_ATOMIC);
+    if (!entry) {
+        goto out;
+    }
+    entry->key = key;
+    entry->modified_at = ktime_get_real();
+    entry->needs_backup = true;
+    
+    existing = rhashtable_lookup_get_insert_fast(&cow_table, &entry->node, cow_params);
+    if (existing) {
+        // Lost an insert race (or the table is mid-resize and full)
+        kmem_cache_free(cow_entry_cache, entry);
+        if (!IS_ERR(existing)) {
+            cow_entry_touch(existing);
+        }
+    } else {
+        atomic_long_inc(&monitored_files);
     }
     
-    spin_unlock_irqrestore(&cow_lock, flags);
+out:
+    corestate_ring_push(&key, pos, count, inode->i_blkbits);
+    rcu_read_unlock();
     
     pr_debug("CoreState: File modified - inode %lu on device %u:%u\n", 
              inode->i_ino, MAJOR(inode->i_sb->s_dev), MINOR(inode->i_sb->s_dev));
@@ -206,6 +456,8 @@ static void corestate_update_stats(void) {
 static int corestate_proc_show(struct seq_file *m, void *v) {
     struct corestate_snapshot *snapshot;
     struct cow_entry *cow_entry;
+    struct rhashtable_iter iter;
+    struct timespec64 modified_at;
     unsigned long flags;
     int cow_count = 0, snapshot_count = 0;
     
@@ -213,22 +465,30 @@ static int corestate_proc_show(struct seq_file *m, void *v) {
     seq_printf(m, "Status: %s\n", module_active ? "Active" : "Inactive");
     seq_printf(m, "Copy-on-Write: %s\n", cow_enabled ? "Enabled" : "Disabled");
     seq_printf(m, "Snapshots: %s\n", snapshot_enabled ? "Enabled" : "Disabled");
-    seq_printf(m, "Monitored Files: %lu\n", monitored_files);
+    seq_printf(m, "Monitored Files: %ld\n", atomic_long_read(&monitored_files));
     seq_printf(m, "Backup Operations: %lu\n", backup_operations);
     seq_printf(m, "\n");
     
     // Show COW entries
     seq_printf(m, "Copy-on-Write Entries:\n");
-    spin_lock_irqsave(&cow_lock, flags);
-    list_for_each_entry(cow_entry, &cow_list, list) {
+    rhashtable_walk_enter(&cow_table, &iter);
+    rhashtable_walk_start(&iter);
+    while ((cow_entry = rhashtable_walk_next(&iter)) != NULL) {
+        if (IS_ERR(cow_entry)) {
+            if (PTR_ERR(cow_entry) == -EAGAIN)
+                continue; // Table resized under the walk; may repeat entries
+            break;
+        }
+        modified_at = ktime_to_timespec64(READ_ONCE(cow_entry->modified_at));
         seq_printf(m, "  Inode: %lu, Device: %u:%u, Modified: %lld.%09ld, Needs Backup: %s\n",
-                   cow_entry->inode,
-                   MAJOR(cow_entry->device), MINOR(cow_entry->device),
-                   cow_entry->modified_at.tv_sec, cow_entry->modified_at.tv_nsec,
-                   cow_entry->needs_backup ? "Yes" : "No");
+                   cow_entry->key.inode,
+                   MAJOR(cow_entry->key.device), MINOR(cow_entry->key.device),
+                   modified_at.tv_sec, modified_at.tv_nsec,
+                   READ_ONCE(cow_entry->needs_backup) ? "Yes" : "No");
         cow_count++;
     }
-    spin_unlock_irqrestore(&cow_lock, flags);
+    rhashtable_walk_stop(&iter);
+    rhashtable_walk_exit(&iter);
     seq_printf(m, "Total COW entries: %d\n\n", cow_count);
     
     // Show snapshots
@@ -319,20 +579,48 @@ static ssize_t corestate_proc_write(struct file *file, const char __user *buffer
     return count;
 }
 
+static void cow_entry_free(void *ptr, void *arg) {
+    kmem_cache_free(cow_entry_cache, ptr);
+}
+
 // Module initialization
 static int __init corestate_init(void) {
+    int ret;
+    
     pr_info("CoreState: Loading kernel module v%s\n", MODULE_VERSION);
     
+    // COW tracking has to exist before /proc can show it
+    cow_entry_cache = KMEM_CACHE(cow_entry, 0);
+    if (!cow_entry_cache) {
+        pr_err("CoreState: Failed to create COW entry cache\n");
+        return -ENOMEM;
+    }
+    ret = rhashtable_init(&cow_table, &cow_params);
+    if (ret) {
+        pr_err("CoreState: Failed to create COW table: %d\n", ret);
+        kmem_cache_destroy(cow_entry_cache);
+        return ret;
+    }
+    ret = corestate_ring_init();
+    if (ret) {
+        pr_err("CoreState: Failed to create event rings: %d\n", ret);
+        rhashtable_destroy(&cow_table);
+        kmem_cache_destroy(cow_entry_cache);
+        return ret;
+    }
+    
     // Create proc entry
     corestate_proc_entry = proc_create(PROC_ENTRY, 0666, NULL, &corestate_proc_ops);
     if (!corestate_proc_entry) {
         pr_err("CoreState: Failed to create proc entry\n");
+        corestate_ring_exit();
+        rhashtable_destroy(&cow_table);
+        kmem_cache_destroy(cow_entry_cache);
         return -ENOMEM;
     }
     
     // Initialize lists
     INIT_LIST_HEAD(&snapshot_list);
-    INIT_LIST_HEAD(&cow_list);
     
     module_active = true;
     
@@ -345,7 +633,6 @@ static int __init corestate_init(void) {
 // Module cleanup
 static void __exit corestate_exit(void) {
     struct corestate_snapshot *snapshot, *snapshot_tmp;
-    struct cow_entry *cow_entry, *cow_tmp;
     unsigned long flags;
     
     pr_info("CoreState: Unloading kernel module\n");
@@ -363,13 +650,12 @@ static void __exit corestate_exit(void) {
     }
     spin_unlock_irqrestore(&snapshot_lock, flags);
     
-    // Clean up COW entries
-    spin_lock_irqsave(&cow_lock, flags);
-    list_for_each_entry_safe(cow_entry, cow_tmp, &cow_list, list) {
-        list_del(&cow_entry->list);
-        kfree(cow_entry);
-    }
-    spin_unlock_irqrestore(&cow_lock, flags);
+    // Clean up COW entries once no writer can still be inserting
+    WRITE_ONCE(cow_enabled, false);
+    synchronize_rcu();
+    rhashtable_free_and_destroy(&cow_table, cow_entry_free, NULL);
+    kmem_cache_destroy(cow_entry_cache);
+    corestate_ring_exit();
     
     module_active = false;
     
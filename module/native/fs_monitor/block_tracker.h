@@ -0,0 +1,1026 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <stdexcept>
+#include <cstdint>
+#include <ctime>
+#include <sys/mman.h>
+
+#include "bplus_tree.h"
+#include "crc32c.h"
+#include "dirty_journal.h"
+#include "kernel_ring.h"
+#include "latency_histogram.h"
+
+// --- Placeholder Implementations and Stubs ---
+
+void trigger_incremental_backup();
+
+// --- Tracker Clock ---
+
+// Wall-clock source for BlockInfo::last_modified, in ticks of a configurable
+// resolution. Resolutions at or above the kernel's coarse clock granularity
+// read CLOCK_REALTIME_COARSE, which the vDSO serves from a cached value
+// without a syscall or TSC read. last_modified is informational only:
+// dirty-since queries use the tracker's sequence numbers, so a wall clock
+// stepping backwards cannot hide writes.
+class TrackerClock {
+public:
+    explicit TrackerClock(std::chrono::nanoseconds resolution)
+        : resolution_ns(resolution.count() > 0 ? static_cast<uint64_t>(resolution.count()) : 1) {
+#ifdef CLOCK_REALTIME_COARSE
+        timespec coarse_res;
+        if (clock_getres(CLOCK_REALTIME_COARSE, &coarse_res) == 0 &&
+            static_cast<uint64_t>(coarse_res.tv_sec) * 1000000000ull + coarse_res.tv_nsec <= resolution_ns) {
+            clock_id = CLOCK_REALTIME_COARSE;
+        }
+#endif
+    }
+
+    uint64_t now() const {
+        timespec ts;
+        clock_gettime(clock_id, &ts);
+        return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec) / resolution_ns;
+    }
+
+    bool is_coarse() const {
+#ifdef CLOCK_REALTIME_COARSE
+        return clock_id == CLOCK_REALTIME_COARSE;
+#else
+        return false;
+#endif
+    }
+
+private:
+    uint64_t resolution_ns;
+    clockid_t clock_id = CLOCK_REALTIME;
+};
+
+// --- Dense Block Map ---
+
+// Compact per-device representation: a dirty bitmap with one bit per block
+// plus a flat array of {last_modified, checksum, sequence} indexed by block
+// number. There are two bitmaps: the live one that writers set bits in and
+// one that holds a frozen epoch until the backup pipeline acknowledges it.
+// Everything lives in a single region that is either an anonymous
+// MAP_NORESERVE mapping (pages only become resident where blocks are
+// written) or caller-provided memory such as a file mapping. A 2 TB volume
+// of 4K blocks needs 64 MB per bitmap.
+class DenseBlockMap {
+public:
+    // last_modified and sequence keep the low 32 bits of the tracker values;
+    // the sequence only advances at checkpoints, so it does not wrap in practice.
+    struct Entry {
+        std::atomic<uint32_t> last_modified;
+        std::atomic<uint32_t> checksum;
+        std::atomic<uint32_t> sequence;
+    };
+    static_assert(sizeof(Entry) == 12, "dense entries must stay 12 bytes");
+
+    static size_t bitmap_words(uint64_t block_count) {
+        return (block_count + 63) / 64;
+    }
+
+    static size_t required_bytes(uint64_t block_count) {
+        return 2 * bitmap_words(block_count) * sizeof(uint64_t) + block_count * sizeof(Entry);
+    }
+
+    // backing must be at least required_bytes(block_count), 8-byte aligned
+    // and zero-initialised on first use. live_slot optionally places the
+    // live-bitmap index in the same persistent storage as the backing.
+    explicit DenseBlockMap(uint64_t block_count, void* backing = nullptr,
+                           std::atomic<unsigned>* live_slot = nullptr)
+        : block_count(block_count), region_size(required_bytes(block_count)),
+          live(live_slot ? live_slot : &own_live) {
+        if (backing) {
+            region = backing;
+        } else {
+            region = mmap(nullptr, region_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (region == MAP_FAILED) {
+                throw std::runtime_error("Failed to map dense block map");
+            }
+            owns_region = true;
+        }
+        size_t words = bitmap_words(block_count);
+        bitmaps[0] = static_cast<std::atomic<uint64_t>*>(region);
+        bitmaps[1] = bitmaps[0] + words;
+        entries = reinterpret_cast<Entry*>(bitmaps[1] + words);
+    }
+
+    ~DenseBlockMap() {
+        if (owns_region) {
+            munmap(region, region_size);
+        }
+    }
+
+    DenseBlockMap(const DenseBlockMap&) = delete;
+    DenseBlockMap& operator=(const DenseBlockMap&) = delete;
+
+    uint64_t size() const { return block_count; }
+
+    void check_range(uint64_t block_num) const {
+        if (block_num >= block_count) {
+            throw std::out_of_range("Block number beyond tracked device");
+        }
+    }
+
+    // Writes the entry only; the block becomes visible once its bit is set.
+    void store(uint64_t block_num, uint32_t timestamp, uint32_t checksum, uint32_t sequence) {
+        Entry& entry = entries[block_num];
+        entry.last_modified.store(timestamp, std::memory_order_relaxed);
+        entry.checksum.store(checksum, std::memory_order_relaxed);
+        entry.sequence.store(sequence, std::memory_order_relaxed);
+    }
+
+    void restamp(uint64_t block_num, uint32_t sequence) {
+        entries[block_num].sequence.store(sequence, std::memory_order_relaxed);
+    }
+
+    // Publishes the blocks in `mask` within bitmap word `word` of the live
+    // bitmap and returns the bits that were previously clear there. All
+    // accesses are sequentially consistent: a writer that re-reads the live
+    // index (or the tracker sequence) after its fetch_or cannot miss a swap
+    // that a concurrent scan has already acted on, so if the epoch flipped
+    // underneath it, it repeats the publish into the new live bitmap and
+    // the block is reported in both epochs rather than lost.
+    uint64_t set_bits(size_t word, uint64_t mask) {
+        unsigned idx = live->load(std::memory_order_seq_cst);
+        uint64_t old = bitmaps[idx][word].fetch_or(mask, std::memory_order_seq_cst);
+        unsigned now = live->load(std::memory_order_seq_cst);
+        if (now != idx) {
+            old = bitmaps[now][word].fetch_or(mask, std::memory_order_seq_cst);
+        }
+        return mask & ~old;
+    }
+
+    // Returns true if the block was clean before this write.
+    bool mark(uint64_t block_num, uint32_t timestamp, uint32_t checksum, uint32_t sequence) {
+        check_range(block_num);
+        store(block_num, timestamp, checksum, sequence);
+        return set_bits(block_num >> 6, uint64_t(1) << (block_num & 63)) != 0;
+    }
+
+    unsigned live_bitmap() const { return live->load(std::memory_order_seq_cst); }
+
+    // Makes the other (cleared) bitmap live and returns the index of the
+    // one that now holds the frozen epoch.
+    unsigned swap_live() {
+        return live->fetch_xor(1, std::memory_order_seq_cst);
+    }
+
+    void clear_bitmap(unsigned idx) {
+        size_t words = bitmap_words(block_count);
+        for (size_t w = 0; w < words; ++w) {
+            bitmaps[idx][w].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Sequential word-at-a-time scan; clean regions cost one load per 64 blocks.
+    template<typename Fn>
+    void for_each_dirty(unsigned idx, Fn&& fn) const {
+        size_t words = bitmap_words(block_count);
+        const std::atomic<uint64_t>* bitmap = bitmaps[idx];
+        for (size_t w = 0; w < words; ++w) {
+            uint64_t word = bitmap[w].load(std::memory_order_seq_cst);
+            while (word) {
+                uint64_t block_num = w * 64 + __builtin_ctzll(word);
+                const Entry& entry = entries[block_num];
+                fn(block_num,
+                   entry.last_modified.load(std::memory_order_relaxed),
+                   entry.checksum.load(std::memory_order_relaxed),
+                   entry.sequence.load(std::memory_order_relaxed));
+                word &= word - 1;
+            }
+        }
+    }
+
+    template<typename Fn>
+    void for_each_dirty(Fn&& fn) const {
+        for_each_dirty(live_bitmap(), std::forward<Fn>(fn));
+    }
+
+    // Visits maximal runs of set bits within each word as (start, length),
+    // in ascending order. Runs that continue into the next word are reported
+    // separately; ExtentBuilder joins them.
+    template<typename Fn>
+    void for_each_dirty_run(unsigned idx, Fn&& fn) const {
+        size_t words = bitmap_words(block_count);
+        const std::atomic<uint64_t>* bitmap = bitmaps[idx];
+        for (size_t w = 0; w < words; ++w) {
+            uint64_t word = bitmap[w].load(std::memory_order_seq_cst);
+            while (word) {
+                unsigned lo = __builtin_ctzll(word);
+                uint64_t rest = ~(word >> lo);
+                unsigned run = rest ? __builtin_ctzll(rest) : 64 - lo;
+                fn(w * 64 + lo, run);
+                word = lo + run == 64 ? 0 : word & ~((uint64_t(1) << (lo + run)) - 1);
+            }
+        }
+    }
+
+private:
+    uint64_t block_count;
+    size_t region_size;
+    void* region = nullptr;
+    bool owns_region = false;
+    std::atomic<uint64_t>* bitmaps[2] = {nullptr, nullptr};
+    std::atomic<unsigned> own_live{0};
+    std::atomic<unsigned>* live;
+    Entry* entries = nullptr;
+};
+
+// --- Extent Coalescing ---
+
+struct BlockExtent {
+    uint64_t start_block;
+    uint64_t length;
+};
+
+struct ExtentOptions {
+    uint64_t max_extent_blocks = 0; // Split longer extents; 0 = unlimited
+    uint64_t merge_gap_blocks = 0;  // Bridge clean gaps up to this size
+};
+
+// Folds ascending block runs into extents for the backup reader. Bridging
+// a gap reads a few clean blocks to save a seek; an extent always starts at
+// a dirty block, and never grows past max_extent_blocks.
+class ExtentBuilder {
+public:
+    explicit ExtentBuilder(const ExtentOptions& options) : options(options) {}
+
+    void add_block(uint64_t block_num) { add_run(block_num, 1); }
+
+    void add_run(uint64_t start, uint64_t length) {
+        const uint64_t max = options.max_extent_blocks;
+        while (length) {
+            uint64_t end = start + length;
+            if (open && start <= current_end() + options.merge_gap_blocks) {
+                uint64_t limit = max ? current.start_block + max : UINT64_MAX;
+                if (start < limit) {
+                    uint64_t take_end = std::min(end, limit);
+                    current.length = std::max(current.length, take_end - current.start_block);
+                    length = end - take_end;
+                    start = take_end;
+                    continue;
+                }
+            }
+            flush();
+            current = {start, max ? std::min(length, max) : length};
+            open = true;
+            start += current.length;
+            length -= current.length;
+        }
+    }
+
+    std::vector<BlockExtent> finish() {
+        flush();
+        return std::move(extents);
+    }
+
+private:
+    uint64_t current_end() const { return current.start_block + current.length; }
+
+    void flush() {
+        if (open) {
+            extents.push_back(current);
+            open = false;
+        }
+    }
+
+    ExtentOptions options;
+    std::vector<BlockExtent> extents;
+    BlockExtent current{0, 0};
+    bool open = false;
+};
+
+// --- Main BlockLevelTracker Class ---
+
+struct BlockTrackerConfig {
+    size_t shard_count = 0;          // Rounded up to a power of two; 0 = one per CPU
+    uint64_t device_blocks = 0;      // Non-zero selects the dense representation
+    void* dense_backing = nullptr;   // Optional memory for the dense map (e.g. a file mapping)
+
+    // Incremental backup trigger. Any enabled condition fires it.
+    size_t incremental_threshold_blocks = 1000;               // Newly dirty blocks; 0 = disabled
+    uint64_t incremental_threshold_bytes = 0;                 // Bytes written; 0 = disabled
+    std::chrono::milliseconds incremental_interval{0};        // Max time between triggers while dirty; 0 = disabled
+    std::chrono::milliseconds trigger_debounce{50};           // Quiet window that folds a burst into one trigger
+    std::chrono::milliseconds trigger_min_interval{1000};     // Rate limit between consecutive triggers
+    std::function<void()> on_incremental_backup = trigger_incremental_backup;
+
+    std::chrono::nanoseconds clock_resolution = std::chrono::seconds(1); // Unit of BlockInfo::last_modified
+
+    // Persist dense tracking state in this file so a restart resumes
+    // incremental tracking. Requires device_blocks; dense_backing is ignored.
+    std::string journal_path;
+    std::chrono::milliseconds journal_checkpoint_interval{30000}; // msync cadence; 0 = only on shutdown
+};
+
+// --- Incremental Backup Trigger ---
+
+// Runs the incremental backup callback on a dedicated thread. Writers only
+// bump atomic counters; the writer that crosses a threshold wakes the
+// thread, which waits out the debounce window and the rate limit before
+// firing once for everything accumulated in the meantime.
+class IncrementalBackupTrigger {
+public:
+    explicit IncrementalBackupTrigger(const BlockTrackerConfig& config)
+        : threshold_blocks(config.incremental_threshold_blocks),
+          threshold_bytes(config.incremental_threshold_bytes),
+          interval(config.incremental_interval),
+          debounce(config.trigger_debounce),
+          min_interval(config.trigger_min_interval),
+          callback(config.on_incremental_backup) {
+        worker = std::thread(&IncrementalBackupTrigger::run, this);
+    }
+
+    ~IncrementalBackupTrigger() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_one();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    IncrementalBackupTrigger(const IncrementalBackupTrigger&) = delete;
+    IncrementalBackupTrigger& operator=(const IncrementalBackupTrigger&) = delete;
+
+    void note_writes(size_t newly_dirty_blocks, uint64_t bytes) {
+        size_t blocks_before = pending_blocks.fetch_add(newly_dirty_blocks, std::memory_order_relaxed);
+        uint64_t bytes_before = pending_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+        bool crossed =
+            (threshold_blocks && blocks_before + newly_dirty_blocks >= threshold_blocks) ||
+            (threshold_bytes && bytes_before + bytes >= threshold_bytes);
+        if (crossed && !signalled.exchange(true, std::memory_order_acq_rel)) {
+            // Taking the mutex orders the flag with the waiter's predicate check.
+            { std::lock_guard<std::mutex> lock(mutex); }
+            wake.notify_one();
+        }
+    }
+
+    uint64_t triggers_fired() const { return fired.load(std::memory_order_relaxed); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    bool has_pending() const {
+        return pending_blocks.load(std::memory_order_relaxed) ||
+               pending_bytes.load(std::memory_order_relaxed);
+    }
+
+    // Sleeps until `deadline` unless shutdown is requested; returns false on shutdown.
+    bool sleep_until(std::unique_lock<std::mutex>& lock, Clock::time_point deadline) {
+        return !wake.wait_until(lock, deadline, [this] { return !running; });
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        Clock::time_point last_trigger = Clock::now();
+
+        while (running) {
+            auto ready = [this] { return !running || signalled.load(std::memory_order_acquire); };
+            if (interval.count() > 0) {
+                wake.wait_until(lock, last_trigger + interval, ready);
+            } else {
+                wake.wait(lock, ready);
+            }
+            if (!running) {
+                break;
+            }
+
+            bool signal = signalled.load(std::memory_order_acquire);
+            bool due = interval.count() > 0 && Clock::now() >= last_trigger + interval;
+            if (!signal && !(due && has_pending())) {
+                if (due) {
+                    last_trigger = Clock::now(); // Nothing to back up; restart the interval
+                }
+                continue;
+            }
+
+            if (!sleep_until(lock, Clock::now() + debounce) ||
+                !sleep_until(lock, last_trigger + min_interval)) {
+                break;
+            }
+
+            signalled.store(false, std::memory_order_release);
+            pending_blocks.store(0, std::memory_order_relaxed);
+            pending_bytes.store(0, std::memory_order_relaxed);
+            last_trigger = Clock::now();
+
+            lock.unlock();
+            if (callback) {
+                callback();
+            }
+            fired.fetch_add(1, std::memory_order_relaxed);
+            lock.lock();
+        }
+    }
+
+    const size_t threshold_blocks;
+    const uint64_t threshold_bytes;
+    const std::chrono::milliseconds interval;
+    const std::chrono::milliseconds debounce;
+    const std::chrono::milliseconds min_interval;
+    const std::function<void()> callback;
+
+    std::atomic<size_t> pending_blocks{0};
+    std::atomic<uint64_t> pending_bytes{0};
+    std::atomic<bool> signalled{false};
+    std::atomic<uint64_t> fired{0};
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running = true;
+    std::thread worker;
+};
+
+// One block write as delivered by the kernel module event feed. Records
+// from the kernel ring carry no payload: `data` is null and the block's
+// checksum is recorded as 0.
+struct WriteRecord {
+    uint64_t block_num;
+    const void* data;
+    size_t size;
+};
+
+inline uint32_t write_checksum(const void* data, size_t size) {
+    return data ? crc32c(data, size) : 0;
+}
+
+class BlockLevelTracker {
+private:
+    struct BlockInfo {
+        uint64_t block_number;
+        uint64_t last_modified;
+        uint32_t checksum;
+        bool is_dirty;
+        uint64_t sequence; // Tracker sequence current when the block was last written
+    };
+
+    // Blocks are striped across shards in runs of 2^stripe_shift so that
+    // sequential writes stay on one shard while independent I/O queues
+    // spread across all of them.
+    static constexpr unsigned stripe_shift = 6;
+
+    // Secondary index key: dirty blocks ordered by write sequence, with the
+    // block number breaking ties so every entry is unique.
+    struct SequenceKey {
+        uint64_t sequence;
+        uint64_t block_number;
+
+        bool operator<(const SequenceKey& other) const {
+            return sequence != other.sequence
+                ? sequence < other.sequence
+                : block_number < other.block_number;
+        }
+    };
+
+    struct IndexedWrite {
+        uint64_t last_modified;
+        uint32_t checksum;
+    };
+
+    // The blocks one shard has seen dirtied during one epoch.
+    struct DirtySet {
+        std::unordered_map<uint64_t, BlockInfo> block_map;
+        // Dirty blocks by (sequence, block).
+        BPlusTree<SequenceKey, IndexedWrite> sequence_index;
+    };
+
+    // Each shard owns its own lock and live dirty set. Aligned to keep the
+    // locks of neighbouring shards off the same cache line.
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unique_ptr<DirtySet> live;
+
+        Shard() : live(std::make_unique<DirtySet>()) {}
+    };
+
+public:
+    // A frozen dirty set handed to the backup pipeline. Nothing writes to it
+    // once freeze_epoch() returns, so it is read without any lock. It stays
+    // valid until ack_epoch(id()).
+    class DirtyEpoch {
+    public:
+        uint64_t id() const { return epoch_id; }
+
+        // Visits every block dirtied during the epoch.
+        template<typename Fn>
+        void for_each_block(Fn&& fn) const {
+            if (dense) {
+                dense->for_each_dirty(dense_bitmap, [&](uint64_t block_num, uint32_t last_modified,
+                                                        uint32_t checksum, uint32_t seq) {
+                    fn(BlockInfo{block_num, last_modified, checksum, true, seq});
+                });
+                return;
+            }
+            for (const auto& set : sets) {
+                for (auto it = set->sequence_index.begin(); it != set->sequence_index.end(); ++it) {
+                    const IndexedWrite& write = it.value();
+                    fn(BlockInfo{it.key().block_number, write.last_modified, write.checksum, true,
+                                 it.key().sequence});
+                }
+            }
+        }
+
+        std::vector<BlockInfo> blocks() const {
+            std::vector<BlockInfo> result;
+            for_each_block([&result](const BlockInfo& info) {
+                result.push_back(info);
+            });
+            return result;
+        }
+
+        // Sorted, coalesced extents covering every block in the epoch. The
+        // dense path turns bitmap words straight into runs.
+        std::vector<BlockExtent> extents(const ExtentOptions& options = {}) const {
+            ExtentBuilder builder(options);
+            if (dense) {
+                dense->for_each_dirty_run(dense_bitmap, [&builder](uint64_t start, uint64_t length) {
+                    builder.add_run(start, length);
+                });
+                return builder.finish();
+            }
+            std::vector<uint64_t> block_nums;
+            for (const auto& set : sets) {
+                for (const auto& [block_num, info] : set->block_map) {
+                    block_nums.push_back(block_num);
+                }
+            }
+            return coalesce(block_nums, builder);
+        }
+
+    private:
+        friend class BlockLevelTracker;
+        uint64_t epoch_id = 0;
+        std::vector<std::unique_ptr<DirtySet>> sets; // Sharded path, one per shard
+        const DenseBlockMap* dense = nullptr;        // Dense path
+        unsigned dense_bitmap = 0;
+    };
+
+private:
+
+    std::unique_ptr<Shard[]> shards;
+    size_t shard_mask;
+    // Declared before the dense map, which may live inside its mapping.
+    std::unique_ptr<DirtyBlockJournal> journal;
+    std::unique_ptr<DenseBlockMap> dense;
+
+    // Frozen epochs awaiting ack_epoch(). Only freezers and ackers take this
+    // lock; writers never do.
+    std::mutex epoch_mutex;
+    std::map<uint64_t, std::unique_ptr<DirtyEpoch>> frozen_epochs;
+    uint64_t next_epoch_id = 1;
+
+    TrackerClock clock;
+    // Logical clock for dirty-since queries. Writers only load it, so the
+    // hot path never contends on it; checkpoint_sequence() advances it.
+    // Sharded writers load it under their shard lock, which makes
+    // checkpoints exact: a write stamped before a checkpoint is complete
+    // before any scan started after it can read the shard.
+    // With a journal the counter lives in the journal header instead.
+    alignas(64) std::atomic<uint64_t> own_sequence{1};
+    std::atomic<uint64_t>* sequence = &own_sequence;
+
+    // Hot-path metrics, see metrics(). Single writes are sampled one in 64
+    // so the clock reads stay off the common case.
+    LatencyHistogram track_write_latency{64};
+    LatencyHistogram track_writes_latency;
+    mutable LatencyHistogram dirty_scan_latency;
+
+    // Declared last so the trigger thread stops before the shards go away.
+    std::unique_ptr<IncrementalBackupTrigger> trigger;
+
+    static size_t default_shard_count() {
+        size_t cpus = std::thread::hardware_concurrency();
+        return cpus ? cpus : 1;
+    }
+
+    static size_t round_up_pow2(size_t n) {
+        size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    size_t shard_index(uint64_t block_num) const {
+        return (block_num >> stripe_shift) & shard_mask;
+    }
+
+    Shard& shard_for(uint64_t block_num) const {
+        return shards[shard_index(block_num)];
+    }
+
+    // Maps the journal and takes the dense map, sequence counter and any
+    // unacknowledged frozen epoch from it.
+    void open_journal(const BlockTrackerConfig& config) {
+        journal = std::make_unique<DirtyBlockJournal>(
+            config.journal_path, config.device_blocks,
+            DenseBlockMap::required_bytes(config.device_blocks),
+            config.journal_checkpoint_interval);
+        DirtyJournalHeader& hdr = journal->header();
+        dense = std::make_unique<DenseBlockMap>(config.device_blocks, journal->region(), &hdr.live_bitmap);
+        sequence = &hdr.sequence;
+
+        // An epoch frozen but not acknowledged before the restart is handed
+        // out again from the non-live bitmap.
+        next_epoch_id = hdr.next_epoch_id;
+        if (hdr.frozen_epoch_id) {
+            auto epoch = std::make_unique<DirtyEpoch>();
+            epoch->epoch_id = hdr.frozen_epoch_id;
+            epoch->dense = dense.get();
+            epoch->dense_bitmap = dense->live_bitmap() ^ 1;
+            frozen_epochs.emplace(epoch->epoch_id, std::move(epoch));
+        }
+    }
+
+    // The dense path has no lock to order writes against checkpoints. If a
+    // checkpoint landed while blocks were being published, they are
+    // re-stamped with the new sequence so the next query reports them even
+    // when the scan for the closing period passed them by.
+    void restamp_if_checkpointed(const WriteRecord* records, size_t count, uint32_t seq) {
+        uint32_t after = static_cast<uint32_t>(sequence->load(std::memory_order_seq_cst));
+        if (after == seq) {
+            return;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            dense->restamp(records[i].block_num, after);
+        }
+    }
+
+    static std::vector<BlockExtent> coalesce(std::vector<uint64_t>& block_nums, ExtentBuilder& builder) {
+        std::sort(block_nums.begin(), block_nums.end());
+        for (uint64_t block_num : block_nums) {
+            builder.add_block(block_num);
+        }
+        return builder.finish();
+    }
+
+    // Records one write in a shard whose lock the caller holds exclusively.
+    // Returns true if the block was clean before.
+    static bool apply_write(DirtySet& set, uint64_t block_num, uint64_t now,
+                            uint64_t seq, uint32_t checksum) {
+        BlockInfo& info = set.block_map[block_num];
+        bool newly_dirty = !info.is_dirty;
+
+        if (!newly_dirty && info.sequence != seq) {
+            set.sequence_index.erase({info.sequence, block_num});
+        }
+
+        info.block_number = block_num;
+        info.last_modified = now;
+        info.checksum = checksum;
+        info.is_dirty = true;
+        info.sequence = seq;
+
+        set.sequence_index.insert({seq, block_num}, {now, checksum});
+        return newly_dirty;
+    }
+
+    void track_writes_dense(const WriteRecord* records, const uint32_t* checksums,
+                            size_t count, uint32_t now, uint64_t bytes) {
+        dense->check_range(records[count - 1].block_num);
+        uint32_t seq = static_cast<uint32_t>(sequence->load(std::memory_order_seq_cst));
+
+        // Records are sorted by block, so runs sharing a bitmap word are
+        // published with a single fetch_or.
+        size_t newly_dirty = 0;
+        size_t i = 0;
+        while (i < count) {
+            size_t word = records[i].block_num >> 6;
+            uint64_t mask = 0;
+            do {
+                dense->store(records[i].block_num, now, checksums[i], seq);
+                mask |= uint64_t(1) << (records[i].block_num & 63);
+                ++i;
+            } while (i < count && (records[i].block_num >> 6) == word);
+            newly_dirty += __builtin_popcountll(dense->set_bits(word, mask));
+        }
+        restamp_if_checkpointed(records, count, seq);
+
+        trigger->note_writes(newly_dirty, bytes);
+    }
+
+public:
+    explicit BlockLevelTracker(const BlockTrackerConfig& config = {})
+        : clock(config.clock_resolution) {
+        size_t count = round_up_pow2(config.shard_count ? config.shard_count : default_shard_count());
+        shards = std::make_unique<Shard[]>(count);
+        shard_mask = count - 1;
+        if (!config.journal_path.empty()) {
+            if (!config.device_blocks) {
+                throw std::invalid_argument("Journaled tracking requires device_blocks");
+            }
+            open_journal(config);
+        } else if (config.device_blocks) {
+            dense = std::make_unique<DenseBlockMap>(config.device_blocks, config.dense_backing);
+        }
+        trigger = std::make_unique<IncrementalBackupTrigger>(config);
+    }
+
+    size_t shard_count() const { return shard_mask + 1; }
+    bool is_dense() const { return dense != nullptr; }
+    uint64_t incremental_triggers() const { return trigger->triggers_fired(); }
+
+    struct Metrics {
+        LatencyHistogram::Snapshot track_write;
+        LatencyHistogram::Snapshot track_writes; // Per batch
+        LatencyHistogram::Snapshot dirty_scan;   // Dirty-since queries and extent scans
+    };
+
+    Metrics metrics() const {
+        return {track_write_latency.snapshot(), track_writes_latency.snapshot(), dirty_scan_latency.snapshot()};
+    }
+
+    // Appends metrics() in the Prometheus text format for a scrape endpoint.
+    void append_metrics(std::string& out, const std::string& prefix = "corestate_tracker") const {
+        Metrics m = metrics();
+        append_prometheus(out, prefix + "_track_write_seconds", m.track_write);
+        append_prometheus(out, prefix + "_track_writes_seconds", m.track_writes);
+        append_prometheus(out, prefix + "_dirty_scan_seconds", m.dirty_scan);
+    }
+
+    bool is_journaled() const { return journal != nullptr; }
+
+    // How the journal was found at startup. Unsafe means blocks dirtied
+    // before the restart may be missing and a full backup is required.
+    DirtyBlockJournal::Recovery journal_recovery() const {
+        return journal ? journal->recovery() : DirtyBlockJournal::Recovery::Created;
+    }
+
+    // Forces a journal checkpoint ahead of the periodic one.
+    void checkpoint_journal() {
+        if (journal) {
+            journal->checkpoint();
+        }
+    }
+
+    void track_write(uint64_t block_num, const void* data, size_t size) {
+        LatencyHistogram::Scope timing(track_write_latency);
+        if (dense) {
+            // The dense map is updated with atomics and needs no shard lock.
+            WriteRecord record{block_num, data, size};
+            uint32_t seq = static_cast<uint32_t>(sequence->load(std::memory_order_seq_cst));
+            bool newly_dirty = dense->mark(block_num, static_cast<uint32_t>(clock.now()),
+                                           write_checksum(data, size), seq);
+            restamp_if_checkpointed(&record, 1, seq);
+            trigger->note_writes(newly_dirty, size);
+            return;
+        }
+
+        // Checksum outside the lock; the critical section only touches metadata.
+        uint32_t checksum = write_checksum(data, size);
+        uint64_t now = clock.now();
+        Shard& shard = shard_for(block_num);
+        bool newly_dirty = false;
+        {
+            std::unique_lock lock(shard.mutex);
+            uint64_t seq = sequence->load(std::memory_order_acquire);
+            newly_dirty = apply_write(*shard.live, block_num, now, seq, checksum);
+        }
+
+        trigger->note_writes(newly_dirty, size);
+    }
+
+    // Bulk ingestion for draining the kernel event feed. Records are sorted
+    // in place so each shard touched by the batch is locked exactly once;
+    // checksums are computed before any lock is taken and the clock is read
+    // once for the whole batch. When a block appears more than once the
+    // last record wins.
+    void track_writes(WriteRecord* records, size_t count) {
+        LatencyHistogram::Scope timing(track_writes_latency);
+        if (count == 0) {
+            return;
+        }
+
+        if (dense) {
+            std::stable_sort(records, records + count,
+                [](const WriteRecord& a, const WriteRecord& b) {
+                    return a.block_num < b.block_num;
+                });
+        } else {
+            std::stable_sort(records, records + count,
+                [this](const WriteRecord& a, const WriteRecord& b) {
+                    size_t sa = shard_index(a.block_num), sb = shard_index(b.block_num);
+                    return sa != sb ? sa < sb : a.block_num < b.block_num;
+                });
+        }
+
+        thread_local std::vector<uint32_t> checksums;
+        checksums.resize(count);
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < count; ++i) {
+            checksums[i] = write_checksum(records[i].data, records[i].size);
+            bytes += records[i].size;
+        }
+        uint64_t now = clock.now();
+
+        if (dense) {
+            track_writes_dense(records, checksums.data(), count, static_cast<uint32_t>(now), bytes);
+            return;
+        }
+
+        size_t newly_dirty = 0;
+        size_t i = 0;
+        while (i < count) {
+            size_t index = shard_index(records[i].block_num);
+            Shard& shard = shards[index];
+            std::unique_lock lock(shard.mutex);
+            uint64_t seq = sequence->load(std::memory_order_acquire);
+            do {
+                newly_dirty += apply_write(*shard.live, records[i].block_num, now, seq, checksums[i]);
+                ++i;
+            } while (i < count && shard_index(records[i].block_num) == index);
+        }
+
+        trigger->note_writes(newly_dirty, bytes);
+    }
+
+    void track_writes(std::vector<WriteRecord>& records) {
+        track_writes(records.data(), records.size());
+    }
+
+    // Moves up to max_records pending kernel ring records into the tracker
+    // as a single track_writes batch. Records carry file-relative blocks of
+    // any inode on any device, so `to_block(record, block)` must check
+    // record.device and translate (inode, record.block) to the tracker
+    // block of the first written block, returning false to skip the record
+    // (another device, an untracked inode). A record spanning several
+    // blocks marks each of them. Blocks past the end of a dense map are
+    // dropped here, since the records are already released to the module
+    // and a throwing batch would lose the rest. Returns the records
+    // consumed, skipped ones included.
+    template<typename ToBlock>
+    size_t drain_kernel_feed(KernelRingReader& feed, ToBlock&& to_block, size_t max_records = SIZE_MAX) {
+        thread_local std::vector<WriteRecord> batch;
+        batch.clear();
+        uint64_t limit = dense ? dense->size() : UINT64_MAX;
+        size_t consumed = feed.drain([&](const corestate_ring_record* records, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t block;
+                if (!to_block(records[i], block) || block >= limit) {
+                    continue;
+                }
+                uint64_t blocks = std::min<uint64_t>(records[i].blocks, limit - block);
+                // The byte count rides on the first block so the backup trigger sees it once.
+                batch.push_back(WriteRecord{block, nullptr, records[i].bytes});
+                for (uint64_t b = 1; b < blocks; ++b) {
+                    batch.push_back(WriteRecord{block + b, nullptr, 0});
+                }
+            }
+        }, max_records);
+        track_writes(batch.data(), batch.size());
+        return consumed;
+    }
+
+    uint64_t current_sequence() const {
+        return sequence->load(std::memory_order_acquire);
+    }
+
+    // Advances the logical clock and returns the new sequence. Passing it to
+    // a later dirty-since query reports the writes made after this call;
+    // writes racing with it may be reported on both sides, never on neither.
+    uint64_t checkpoint_sequence() {
+        return sequence->fetch_add(1, std::memory_order_seq_cst) + 1;
+    }
+
+    // Visits every block in the live epoch whose sequence is at least
+    // since_sequence. On the sharded path each shard is walked from a B+ tree
+    // lower_bound, so the cost is O(log n + k) per shard, and only one
+    // shard's shared lock is held at a time, so writers are only held off
+    // the shard currently being read. fn must not call back into the tracker.
+    template<typename Fn>
+    void for_each_dirty_block(uint64_t since_sequence, Fn&& fn) const {
+        LatencyHistogram::Scope timing(dirty_scan_latency);
+        if (dense) {
+            uint32_t since = static_cast<uint32_t>(since_sequence);
+            dense->for_each_dirty([&](uint64_t block_num, uint32_t last_modified,
+                                      uint32_t checksum, uint32_t seq) {
+                if (seq >= since) {
+                    fn(BlockInfo{block_num, last_modified, checksum, true, seq});
+                }
+            });
+            return;
+        }
+
+        for (size_t i = 0; i <= shard_mask; ++i) {
+            const Shard& shard = shards[i];
+            std::shared_lock lock(shard.mutex);
+            const auto& index = shard.live->sequence_index;
+            for (auto it = index.lower_bound({since_sequence, 0}); it != index.end(); ++it) {
+                const IndexedWrite& write = it.value();
+                fn(BlockInfo{it.key().block_number, write.last_modified, write.checksum, true,
+                             it.key().sequence});
+            }
+        }
+    }
+
+    // Like get_dirty_blocks, but returns sorted extents so the backup reader
+    // can issue large sequential reads.
+    std::vector<BlockExtent> get_dirty_extents(uint64_t since_sequence,
+                                               const ExtentOptions& options = {}) const {
+        ExtentBuilder builder(options);
+        if (dense) {
+            // Dense scans already visit blocks in ascending order.
+            for_each_dirty_block(since_sequence, [&builder](const BlockInfo& info) {
+                builder.add_block(info.block_number);
+            });
+            return builder.finish();
+        }
+        std::vector<uint64_t> block_nums;
+        for_each_dirty_block(since_sequence, [&block_nums](const BlockInfo& info) {
+            block_nums.push_back(info.block_number);
+        });
+        return coalesce(block_nums, builder);
+    }
+
+    // Swaps in a fresh live dirty set and returns the previous one, frozen.
+    // Each shard is locked only for a pointer swap (the fresh sets are
+    // allocated beforehand) and the dense path flips bitmaps atomically, so
+    // live I/O is never held up while the backup pipeline walks the epoch.
+    // Every write lands in exactly one epoch on the sharded path; a dense
+    // write racing with the flip may be reported in both.
+    const DirtyEpoch& freeze_epoch() {
+        std::lock_guard<std::mutex> guard(epoch_mutex);
+        auto epoch = std::make_unique<DirtyEpoch>();
+        epoch->epoch_id = next_epoch_id;
+
+        if (dense) {
+            for (const auto& [id, frozen] : frozen_epochs) {
+                if (frozen->dense) {
+                    throw std::runtime_error("Previous dense epoch has not been acknowledged");
+                }
+            }
+            epoch->dense = dense.get();
+            if (journal) {
+                // Recorded before the flip: a crash in between leaves at
+                // worst an empty frozen epoch, never a lost live bitmap.
+                journal->header().frozen_epoch_id = epoch->epoch_id;
+                journal->header().next_epoch_id = epoch->epoch_id + 1;
+            }
+            epoch->dense_bitmap = dense->swap_live();
+        } else {
+            std::vector<std::unique_ptr<DirtySet>> fresh(shard_mask + 1);
+            for (auto& set : fresh) {
+                set = std::make_unique<DirtySet>();
+            }
+            for (size_t i = 0; i <= shard_mask; ++i) {
+                std::unique_lock lock(shards[i].mutex);
+                shards[i].live.swap(fresh[i]);
+            }
+            epoch->sets = std::move(fresh);
+        }
+
+        next_epoch_id++;
+        const DirtyEpoch& result = *epoch;
+        frozen_epochs.emplace(result.epoch_id, std::move(epoch));
+        return result;
+    }
+
+    // Releases a frozen epoch once its blocks are safely backed up. Returns
+    // false if the id is unknown or was already acknowledged.
+    bool ack_epoch(uint64_t id) {
+        std::unique_ptr<DirtyEpoch> epoch;
+        {
+            std::lock_guard<std::mutex> guard(epoch_mutex);
+            auto it = frozen_epochs.find(id);
+            if (it == frozen_epochs.end()) {
+                return false;
+            }
+            epoch = std::move(it->second);
+            frozen_epochs.erase(it);
+            if (epoch->dense) {
+                dense->clear_bitmap(epoch->dense_bitmap);
+                if (journal) {
+                    journal->header().frozen_epoch_id = 0;
+                }
+            }
+        }
+        // Sharded sets are destroyed here, outside every lock.
+        return true;
+    }
+
+    std::vector<BlockInfo> get_dirty_blocks(uint64_t since_sequence) const {
+        std::vector<BlockInfo> result;
+        for_each_dirty_block(since_sequence, [&result](const BlockInfo& info) {
+            result.push_back(info);
+        });
+        return result;
+    }
+};
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+
+// --- B+ Tree ---
+
+// In-memory B+ tree with cache-line aligned nodes sized to NodeBytes.
+// Leaves are doubly linked so ordered iteration from lower_bound() is
+// O(log n + k). Deletion is free-at-empty: leaves are unlinked and released
+// once they hold no keys instead of being merged at half occupancy, which
+// keeps erase cheap for the append-mostly, time-ordered workloads this index
+// serves while still reclaiming memory as old keys age out.
+template<typename K, typename V, size_t NodeBytes = 256>
+class BPlusTree {
+private:
+    static constexpr size_t cache_line = 64;
+    static constexpr size_t header_bytes = 16;
+
+    static constexpr size_t leaf_capacity =
+        std::max<size_t>(4, (NodeBytes - header_bytes - 2 * sizeof(void*)) / (sizeof(K) + sizeof(V)));
+    static constexpr size_t inner_capacity =
+        std::max<size_t>(4, (NodeBytes - header_bytes - sizeof(void*)) / (sizeof(K) + sizeof(void*)));
+
+    struct Node {
+        bool leaf;
+        uint16_t count; // Keys held by this node
+    };
+
+    struct alignas(cache_line) Leaf : Node {
+        Leaf* prev = nullptr;
+        Leaf* next = nullptr;
+        K keys[leaf_capacity];
+        V values[leaf_capacity];
+        Leaf() : Node{true, 0} {}
+    };
+
+    // An inner node with `count` keys has `count + 1` children; keys[i] is a
+    // lower bound for every key below children[i + 1].
+    struct alignas(cache_line) Inner : Node {
+        K keys[inner_capacity];
+        Node* children[inner_capacity + 1];
+        Inner() : Node{false, 0} {}
+    };
+
+    struct Split {
+        K separator;
+        Node* right = nullptr;
+    };
+
+    Node* root;
+    size_t element_count = 0;
+
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<const K&, V&>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        iterator() = default;
+
+        const K& key() const { return leaf->keys[index]; }
+        V& value() const { return leaf->values[index]; }
+        reference operator*() const { return {leaf->keys[index], leaf->values[index]}; }
+
+        iterator& operator++() {
+            if (++index >= leaf->count) {
+                leaf = leaf->next;
+                index = 0;
+            }
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const iterator& other) const {
+            return leaf == other.leaf && index == other.index;
+        }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+        friend class BPlusTree;
+        iterator(Leaf* l, uint16_t i) : leaf(l), index(i) {}
+        Leaf* leaf = nullptr;
+        uint16_t index = 0;
+    };
+
+    BPlusTree() : root(new Leaf()) {}
+    ~BPlusTree() { destroy(root); }
+
+    BPlusTree(const BPlusTree&) = delete;
+    BPlusTree& operator=(const BPlusTree&) = delete;
+
+    size_t size() const { return element_count; }
+    bool empty() const { return element_count == 0; }
+
+    iterator begin() const {
+        Node* node = root;
+        while (!node->leaf) {
+            node = static_cast<Inner*>(node)->children[0];
+        }
+        Leaf* leaf = static_cast<Leaf*>(node);
+        return leaf->count ? iterator(leaf, 0) : end();
+    }
+
+    iterator end() const { return iterator(); }
+
+    // First element whose key is not less than `key`.
+    iterator lower_bound(const K& key) const {
+        Leaf* leaf = find_leaf(key);
+        uint16_t pos = static_cast<uint16_t>(std::lower_bound(leaf->keys, leaf->keys + leaf->count, key) - leaf->keys);
+        if (pos < leaf->count) {
+            return iterator(leaf, pos);
+        }
+        return leaf->next ? iterator(leaf->next, 0) : end();
+    }
+
+    iterator find(const K& key) const {
+        iterator it = lower_bound(key);
+        if (it != end() && !(key < it.key())) {
+            return it;
+        }
+        return end();
+    }
+
+    // Inserts or overwrites the value stored under `key`.
+    void insert(const K& key, const V& value) {
+        Split split;
+        if (insert_into(root, key, value, split)) {
+            Inner* new_root = new Inner();
+            new_root->count = 1;
+            new_root->keys[0] = split.separator;
+            new_root->children[0] = root;
+            new_root->children[1] = split.right;
+            root = new_root;
+        }
+    }
+
+    bool erase(const K& key) {
+        bool erased = false;
+        if (erase_from(root, key, erased)) {
+            root = new Leaf();
+        }
+        // Collapse inner roots left with a single child.
+        while (!root->leaf && root->count == 0) {
+            Inner* old_root = static_cast<Inner*>(root);
+            root = old_root->children[0];
+            delete old_root;
+        }
+        return erased;
+    }
+
+    void clear() {
+        destroy(root);
+        root = new Leaf();
+        element_count = 0;
+    }
+
+private:
+    static size_t child_index(const Inner* inner, const K& key) {
+        return std::upper_bound(inner->keys, inner->keys + inner->count, key) - inner->keys;
+    }
+
+    Leaf* find_leaf(const K& key) const {
+        Node* node = root;
+        while (!node->leaf) {
+            Inner* inner = static_cast<Inner*>(node);
+            node = inner->children[child_index(inner, key)];
+        }
+        return static_cast<Leaf*>(node);
+    }
+
+    // Returns true if `node` split, with the new right sibling in `split`.
+    bool insert_into(Node* node, const K& key, const V& value, Split& split) {
+        if (node->leaf) {
+            return insert_into_leaf(static_cast<Leaf*>(node), key, value, split);
+        }
+
+        Inner* inner = static_cast<Inner*>(node);
+        size_t idx = child_index(inner, key);
+        Split child_split;
+        if (!insert_into(inner->children[idx], key, value, child_split)) {
+            return false;
+        }
+
+        if (inner->count < inner_capacity) {
+            insert_child(inner, idx, child_split);
+            return false;
+        }
+
+        // Split a full inner node: the middle key moves up.
+        Inner* right = new Inner();
+        size_t mid = inner_capacity / 2;
+        split.separator = inner->keys[mid];
+        right->count = static_cast<uint16_t>(inner_capacity - mid - 1);
+        std::copy(inner->keys + mid + 1, inner->keys + inner_capacity, right->keys);
+        std::copy(inner->children + mid + 1, inner->children + inner_capacity + 1, right->children);
+        inner->count = static_cast<uint16_t>(mid);
+        split.right = right;
+
+        if (idx <= mid) {
+            insert_child(inner, idx, child_split);
+        } else {
+            insert_child(right, idx - mid - 1, child_split);
+        }
+        return true;
+    }
+
+    static void insert_child(Inner* inner, size_t idx, const Split& child_split) {
+        std::copy_backward(inner->keys + idx, inner->keys + inner->count, inner->keys + inner->count + 1);
+        std::copy_backward(inner->children + idx + 1, inner->children + inner->count + 1,
+                           inner->children + inner->count + 2);
+        inner->keys[idx] = child_split.separator;
+        inner->children[idx + 1] = child_split.right;
+        inner->count++;
+    }
+
+    bool insert_into_leaf(Leaf* leaf, const K& key, const V& value, Split& split) {
+        size_t pos = std::lower_bound(leaf->keys, leaf->keys + leaf->count, key) - leaf->keys;
+        if (pos < leaf->count && !(key < leaf->keys[pos])) {
+            leaf->values[pos] = value;
+            return false;
+        }
+        element_count++;
+
+        if (leaf->count < leaf_capacity) {
+            insert_at(leaf, pos, key, value);
+            return false;
+        }
+
+        Leaf* right = new Leaf();
+        size_t mid = leaf_capacity / 2;
+        right->count = static_cast<uint16_t>(leaf_capacity - mid);
+        std::copy(leaf->keys + mid, leaf->keys + leaf_capacity, right->keys);
+        std::copy(leaf->values + mid, leaf->values + leaf_capacity, right->values);
+        leaf->count = static_cast<uint16_t>(mid);
+
+        right->next = leaf->next;
+        right->prev = leaf;
+        if (leaf->next) {
+            leaf->next->prev = right;
+        }
+        leaf->next = right;
+
+        if (pos <= mid) {
+            insert_at(leaf, pos, key, value);
+        } else {
+            insert_at(right, pos - mid, key, value);
+        }
+        split.separator = right->keys[0];
+        split.right = right;
+        return true;
+    }
+
+    static void insert_at(Leaf* leaf, size_t pos, const K& key, const V& value) {
+        std::copy_backward(leaf->keys + pos, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+        std::copy_backward(leaf->values + pos, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+        leaf->keys[pos] = key;
+        leaf->values[pos] = value;
+        leaf->count++;
+    }
+
+    // Returns true if `node` became empty and was released.
+    bool erase_from(Node*& node, const K& key, bool& erased) {
+        if (node->leaf) {
+            Leaf* leaf = static_cast<Leaf*>(node);
+            size_t pos = std::lower_bound(leaf->keys, leaf->keys + leaf->count, key) - leaf->keys;
+            if (pos == leaf->count || key < leaf->keys[pos]) {
+                return false;
+            }
+            std::copy(leaf->keys + pos + 1, leaf->keys + leaf->count, leaf->keys + pos);
+            std::copy(leaf->values + pos + 1, leaf->values + leaf->count, leaf->values + pos);
+            leaf->count--;
+            element_count--;
+            erased = true;
+            if (leaf->count > 0 || node == root) {
+                return false;
+            }
+            if (leaf->prev) leaf->prev->next = leaf->next;
+            if (leaf->next) leaf->next->prev = leaf->prev;
+            delete leaf;
+            node = nullptr;
+            return true;
+        }
+
+        Inner* inner = static_cast<Inner*>(node);
+        size_t idx = child_index(inner, key);
+        if (!erase_from(inner->children[idx], key, erased)) {
+            return false;
+        }
+
+        if (inner->count == 0) {
+            // The only child is gone, so this subtree is empty too.
+            delete inner;
+            node = nullptr;
+            return true;
+        }
+
+        // Drop the empty child together with the separator that bounds it.
+        size_t key_idx = idx > 0 ? idx - 1 : 0;
+        std::copy(inner->keys + key_idx + 1, inner->keys + inner->count, inner->keys + key_idx);
+        std::copy(inner->children + idx + 1, inner->children + inner->count + 1, inner->children + idx);
+        inner->count--;
+        return false;
+    }
+
+    static void destroy(Node* node) {
+        if (!node) {
+            return;
+        }
+        if (node->leaf) {
+            delete static_cast<Leaf*>(node);
+            return;
+        }
+        Inner* inner = static_cast<Inner*>(node);
+        for (size_t i = 0; i <= inner->count; ++i) {
+            destroy(inner->children[i]);
+        }
+        delete inner;
+    }
+};
@@ -0,0 +1,64 @@
+#ifndef CORESTATE_RING_H
+#define CORESTATE_RING_H
+
+/*
+ * Shared layout of the write-event rings the kernel module exports through
+ * /dev/corestate_ring. Included by both corestate_module.c and fs_monitor.
+ *
+ * The device maps as one region: a corestate_ring_info page, then one ring
+ * per possible CPU at ring_offset + cpu * ring_stride. Each ring is a
+ * single-producer/single-consumer queue: the module appends on the CPU that
+ * saw the write with preemption disabled and publishes `head` with release
+ * semantics; the one consumer reads records up to `head` and then releases
+ * them by storing `tail`. Both counters only grow; a record's slot is
+ * `counter & (capacity - 1)`. When a ring is full the record is dropped and
+ * counted in `dropped`, so a consumer that sees the counter move must fall
+ * back to a full rescan.
+ *
+ * The feed is inert for now: records come only from corestate_file_modified(),
+ * and the module does not yet register the write hook that would call it, so
+ * the rings stay empty. Consumers must keep their own source of dirty blocks
+ * until it is wired.
+ */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define CORESTATE_RING_DEVICE "/dev/corestate_ring"
+#define CORESTATE_RING_MAGIC 0x43535247 /* "CSRG" */
+#define CORESTATE_RING_VERSION 1
+
+/* Registers an eventfd (int fd; -1 clears it) signalled when a ring goes non-empty */
+#define CORESTATE_RING_IOC_SET_EVENTFD _IOW('C', 1, int)
+
+struct corestate_ring_info {
+    __u32 magic;
+    __u32 version;
+    __u32 ring_count;     /* One per possible CPU */
+    __u32 capacity;       /* Records per ring, a power of two */
+    __u64 ring_offset;    /* Offset of ring 0 in the mapping */
+    __u64 ring_stride;    /* Bytes between consecutive rings */
+    __u64 records_offset; /* Offset of the record array within a ring */
+    __u64 map_bytes;      /* Size of the whole mapping */
+};
+
+/* Producer and consumer counters sit on separate cache lines. */
+struct corestate_ring_header {
+    __u64 head;    /* Written by the module */
+    __u64 dropped; /* Records lost to a full ring */
+    __u8 producer_pad[48];
+    __u64 tail;    /* Written by the consumer */
+    __u8 consumer_pad[56];
+};
+
+/* One write: `blocks` file system blocks starting at `block` of `inode`. */
+struct corestate_ring_record {
+    __u64 block;
+    __u64 inode;
+    __u32 device; /* new_encode_dev() form */
+    __u32 blocks;
+    __u32 bytes;
+    __u32 reserved;
+};
+
+#endif /* CORESTATE_RING_H */
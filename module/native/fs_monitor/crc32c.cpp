@@ -0,0 +1,271 @@
+#include "crc32c.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+// --- Portable Slicing-by-8 ---
+
+namespace {
+
+constexpr uint32_t crc32c_poly = 0x82f63b78; // Reflected Castagnoli polynomial
+
+using SliceTables = std::array<std::array<uint32_t, 256>, 8>;
+
+constexpr SliceTables make_slice_tables() {
+    SliceTables tables{};
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; ++k) {
+            crc = crc & 1 ? (crc >> 1) ^ crc32c_poly : crc >> 1;
+        }
+        tables[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t crc = tables[0][n];
+        for (size_t k = 1; k < 8; ++k) {
+            crc = tables[0][crc & 0xff] ^ (crc >> 8);
+            tables[k][n] = crc;
+        }
+    }
+    return tables;
+}
+
+constexpr SliceTables slice_tables = make_slice_tables();
+
+uint64_t load_le64(const unsigned char* p) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+uint32_t crc32c_sw(uint32_t crc, const void* data, size_t size) {
+    const unsigned char* next = static_cast<const unsigned char*>(data);
+    uint64_t crc0 = crc ^ 0xffffffffu;
+
+    while (size >= 8) {
+        uint64_t word = crc0 ^ load_le64(next);
+        crc0 = slice_tables[7][word & 0xff] ^
+               slice_tables[6][(word >> 8) & 0xff] ^
+               slice_tables[5][(word >> 16) & 0xff] ^
+               slice_tables[4][(word >> 24) & 0xff] ^
+               slice_tables[3][(word >> 32) & 0xff] ^
+               slice_tables[2][(word >> 40) & 0xff] ^
+               slice_tables[1][(word >> 48) & 0xff] ^
+               slice_tables[0][word >> 56];
+        next += 8;
+        size -= 8;
+    }
+    while (size) {
+        crc0 = slice_tables[0][(crc0 ^ *next++) & 0xff] ^ (crc0 >> 8);
+        size--;
+    }
+    return static_cast<uint32_t>(crc0) ^ 0xffffffffu;
+}
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+// --- Stream Combination ---
+
+// The hardware instructions have a multi-cycle latency but pipeline well,
+// so large buffers are split into three independent streams whose CRCs are
+// merged afterwards. Merging shifts a CRC over `len` zero bytes, done here
+// with per-byte lookup tables for the operator x^(8*len) mod P.
+constexpr size_t long_stream = 1024;  // 3 KB per pass, sized for 4K blocks
+constexpr size_t short_stream = 128;
+
+using ShiftTables = std::array<std::array<uint32_t, 256>, 4>;
+
+uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+void gf2_matrix_square(uint32_t* square, const uint32_t* mat) {
+    for (int n = 0; n < 32; ++n) {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+// Operator that appends `len` zero bytes to a CRC; len is a power of two.
+void crc32c_zeros_op(uint32_t* even, size_t len) {
+    uint32_t odd[32];
+    odd[0] = crc32c_poly; // Operator for one zero bit
+    uint32_t row = 1;
+    for (int n = 1; n < 32; ++n) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2_matrix_square(even, odd); // Two zero bits
+    gf2_matrix_square(odd, even); // Four zero bits
+    do {
+        gf2_matrix_square(even, odd);
+        len >>= 1;
+        if (len == 0) return;
+        gf2_matrix_square(odd, even);
+        len >>= 1;
+    } while (len);
+    std::memcpy(even, odd, sizeof(odd));
+}
+
+ShiftTables make_shift_tables(size_t len) {
+    uint32_t op[32];
+    crc32c_zeros_op(op, len);
+    ShiftTables tables{};
+    for (uint32_t n = 0; n < 256; ++n) {
+        tables[0][n] = gf2_matrix_times(op, n);
+        tables[1][n] = gf2_matrix_times(op, n << 8);
+        tables[2][n] = gf2_matrix_times(op, n << 16);
+        tables[3][n] = gf2_matrix_times(op, n << 24);
+    }
+    return tables;
+}
+
+const ShiftTables& long_shift() {
+    static const ShiftTables tables = make_shift_tables(long_stream);
+    return tables;
+}
+
+const ShiftTables& short_shift() {
+    static const ShiftTables tables = make_shift_tables(short_stream);
+    return tables;
+}
+
+uint32_t crc32c_shift(const ShiftTables& zeros, uint32_t crc) {
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+           zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+#endif
+
+// --- Hardware Kernels ---
+
+#if defined(__x86_64__)
+
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#define CRC32C_U8(crc, v) _mm_crc32_u8(static_cast<uint32_t>(crc), v)
+#define CRC32C_U64(crc, v) _mm_crc32_u64(crc, v)
+constexpr const char* hw_name = "sse4.2";
+
+bool hw_supported() {
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2);
+}
+
+#elif defined(__aarch64__)
+
+#if defined(__clang__)
+#define CRC32C_TARGET __attribute__((target("crc")))
+#else
+#define CRC32C_TARGET __attribute__((target("+crc")))
+#endif
+#define CRC32C_U8(crc, v) __crc32cb(static_cast<uint32_t>(crc), v)
+#define CRC32C_U64(crc, v) __crc32cd(static_cast<uint32_t>(crc), v)
+constexpr const char* hw_name = "armv8-crc";
+
+bool hw_supported() {
+    return getauxval(AT_HWCAP) & HWCAP_CRC32;
+}
+
+#endif
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+CRC32C_TARGET
+void crc32c_hw_streams(uint64_t& crc0, const unsigned char*& next, size_t& size,
+                       size_t stream, const ShiftTables& shift) {
+    while (size >= stream * 3) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        const unsigned char* end = next + stream;
+        do {
+            crc0 = CRC32C_U64(crc0, load_le64(next));
+            crc1 = CRC32C_U64(crc1, load_le64(next + stream));
+            crc2 = CRC32C_U64(crc2, load_le64(next + stream * 2));
+            next += 8;
+        } while (next < end);
+        crc0 = crc32c_shift(shift, static_cast<uint32_t>(crc0)) ^ crc1;
+        crc0 = crc32c_shift(shift, static_cast<uint32_t>(crc0)) ^ crc2;
+        next += stream * 2;
+        size -= stream * 3;
+    }
+}
+
+CRC32C_TARGET
+uint32_t crc32c_hw(uint32_t crc, const void* data, size_t size) {
+    const unsigned char* next = static_cast<const unsigned char*>(data);
+    uint64_t crc0 = crc ^ 0xffffffffu;
+
+    while (size && (reinterpret_cast<uintptr_t>(next) & 7) != 0) {
+        crc0 = CRC32C_U8(crc0, *next++);
+        size--;
+    }
+
+    crc32c_hw_streams(crc0, next, size, long_stream, long_shift());
+    crc32c_hw_streams(crc0, next, size, short_stream, short_shift());
+
+    while (size >= 8) {
+        crc0 = CRC32C_U64(crc0, load_le64(next));
+        next += 8;
+        size -= 8;
+    }
+    while (size) {
+        crc0 = CRC32C_U8(crc0, *next++);
+        size--;
+    }
+    return static_cast<uint32_t>(crc0) ^ 0xffffffffu;
+}
+
+#endif
+
+// --- Dispatch ---
+
+using Crc32cFn = uint32_t (*)(uint32_t, const void*, size_t);
+
+struct Crc32cImpl {
+    Crc32cFn fn;
+    const char* name;
+};
+
+Crc32cImpl select_impl() {
+#if defined(__x86_64__) || defined(__aarch64__)
+    if (hw_supported()) {
+        // Build the shift tables now rather than on the first large buffer.
+        long_shift();
+        short_shift();
+        return {crc32c_hw, hw_name};
+    }
+#endif
+    return {crc32c_sw, "slicing-by-8"};
+}
+
+const Crc32cImpl& active_impl() {
+    static const Crc32cImpl impl = select_impl();
+    return impl;
+}
+
+} // namespace
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t size) {
+    return active_impl().fn(crc, data, size);
+}
+
+const char* crc32c_implementation() {
+    return active_impl().name;
+}
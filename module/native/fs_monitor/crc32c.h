@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli) with runtime dispatch: SSE4.2 on x86-64, the ARMv8
+// CRC extension on arm64, and a portable slicing-by-8 fallback elsewhere.
+// `crc` is the value returned by a previous call, so buffers can be
+// checksummed incrementally; start from 0.
+uint32_t crc32c(uint32_t crc, const void* data, size_t size);
+
+inline uint32_t crc32c(const void* data, size_t size) {
+    return crc32c(0, data, size);
+}
+
+// Name of the implementation selected for this CPU ("sse4.2", "armv8-crc"
+// or "slicing-by-8").
+const char* crc32c_implementation();
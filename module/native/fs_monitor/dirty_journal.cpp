@@ -0,0 +1,140 @@
+#include "dirty_journal.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+std::string current_boot_id() {
+    std::ifstream in("/proc/sys/kernel/random/boot_id");
+    std::string id;
+    std::getline(in, id);
+    return id;
+}
+
+void sync_range(void* addr, size_t size) {
+    if (msync(addr, size, MS_SYNC) != 0) {
+        throw std::runtime_error("Failed to sync dirty block journal");
+    }
+}
+
+} // namespace
+
+DirtyBlockJournal::DirtyBlockJournal(const std::string& path, uint64_t block_count,
+                                     size_t region_bytes, std::chrono::milliseconds checkpoint_interval)
+    : mapped_bytes(header_bytes + region_bytes), interval(checkpoint_interval) {
+    static_assert(sizeof(DirtyJournalHeader) <= header_bytes, "journal header must fit its page");
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open dirty block journal: " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat dirty block journal: " + path);
+    }
+    bool fresh = st.st_size == 0;
+    if (!fresh && static_cast<size_t>(st.st_size) != mapped_bytes) {
+        close(fd);
+        throw std::runtime_error("Dirty block journal size does not match device: " + path);
+    }
+    if (fresh && ftruncate(fd, static_cast<off_t>(mapped_bytes)) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to size dirty block journal: " + path);
+    }
+
+    base = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Failed to map dirty block journal: " + path);
+    }
+
+    DirtyJournalHeader& hdr = header();
+    std::string boot_id = current_boot_id();
+
+    if (fresh) {
+        hdr.magic = journal_magic;
+        hdr.version = journal_version;
+        hdr.block_count = block_count;
+        hdr.next_epoch_id = 1;
+        hdr.frozen_epoch_id = 0;
+        hdr.checkpoints = 0;
+        hdr.sequence.store(1, std::memory_order_relaxed);
+        hdr.live_bitmap.store(0, std::memory_order_relaxed);
+        recovery_state = Recovery::Created;
+    } else {
+        if (hdr.magic != journal_magic || hdr.version != journal_version ||
+            hdr.block_count != block_count) {
+            munmap(base, mapped_bytes);
+            close(fd);
+            throw std::runtime_error("Dirty block journal does not match device: " + path);
+        }
+        if (hdr.clean_shutdown) {
+            recovery_state = Recovery::CleanShutdown;
+        } else if (!boot_id.empty() && boot_id == hdr.boot_id) {
+            recovery_state = Recovery::Restarted;
+        } else {
+            recovery_state = Recovery::Unsafe;
+        }
+    }
+
+    // Mark the journal open before any tracking starts, so a crash from
+    // here on is never mistaken for a clean shutdown.
+    std::memset(hdr.boot_id, 0, sizeof(hdr.boot_id));
+    std::strncpy(hdr.boot_id, boot_id.c_str(), sizeof(hdr.boot_id) - 1);
+    hdr.clean_shutdown = 0;
+    sync_range(base, header_bytes);
+
+    if (interval.count() > 0) {
+        worker = std::thread(&DirtyBlockJournal::run_checkpoints, this);
+    }
+}
+
+DirtyBlockJournal::~DirtyBlockJournal() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wake.notify_one();
+    if (worker.joinable()) {
+        worker.join();
+    }
+
+    try {
+        checkpoint();
+        header().clean_shutdown = 1;
+        sync_range(base, header_bytes);
+    } catch (const std::exception&) {
+        // Left marked unclean; the next open reports it.
+    }
+    munmap(base, mapped_bytes);
+    close(fd);
+}
+
+void DirtyBlockJournal::checkpoint() {
+    std::lock_guard<std::mutex> lock(checkpoint_mutex);
+    // Region first so a synced header never describes unsynced bitmaps.
+    sync_range(region(), mapped_bytes - header_bytes);
+    header().checkpoints++;
+    sync_range(base, header_bytes);
+}
+
+void DirtyBlockJournal::run_checkpoints() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wake.wait_for(lock, interval, [this] { return !running; })) {
+        lock.unlock();
+        try {
+            checkpoint();
+        } catch (const std::exception&) {
+            // Retried on the next interval.
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// --- Dirty Block Journal ---
+
+// On-disk header, kept in the first page of the journal file. The fields
+// the tracker changes at runtime are updated in place through the shared
+// mapping, so they survive a daemon crash without any msync.
+struct DirtyJournalHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t clean_shutdown;
+    uint64_t block_count;
+    uint64_t next_epoch_id;
+    uint64_t frozen_epoch_id;           // 0 when no epoch awaits acknowledgement
+    uint64_t checkpoints;
+    std::atomic<uint64_t> sequence;     // Tracker logical clock
+    std::atomic<unsigned> live_bitmap;  // Which dense bitmap is live
+    char boot_id[40];
+};
+
+// File-backed storage for a dense block tracker: a header page followed by
+// the DenseBlockMap region, mapped MAP_SHARED. Because every bit a writer
+// sets lands directly in the page cache, a restarted daemon picks up
+// exactly where the previous one stopped without rescanning the volume.
+// A background thread msyncs the mapping at a fixed interval so writeback
+// stays cheap and incremental, and a clean shutdown only has the tail to
+// flush.
+//
+// After an unclean shutdown the boot id tells the two cases apart: within
+// the same boot the page cache is intact and the state is exact, while
+// after a reboot anything dirtied since the last msync may be missing, so
+// the caller must fall back to a full backup.
+class DirtyBlockJournal {
+public:
+    enum class Recovery {
+        Created,        // New journal, nothing tracked yet
+        CleanShutdown,  // Previous owner closed the journal
+        Restarted,      // Previous owner died; page cache intact
+        Unsafe          // Reboot without clean shutdown; state may be stale
+    };
+
+    static constexpr uint64_t journal_magic = 0x4c4e524a54534343ull; // "CCSTJRNL"
+    static constexpr uint32_t journal_version = 1;
+    static constexpr size_t header_bytes = 4096;
+
+    // region_bytes is the size of the dense block map stored after the
+    // header. An interval of zero disables background checkpoints.
+    DirtyBlockJournal(const std::string& path, uint64_t block_count, size_t region_bytes,
+                      std::chrono::milliseconds checkpoint_interval);
+    ~DirtyBlockJournal();
+
+    DirtyBlockJournal(const DirtyBlockJournal&) = delete;
+    DirtyBlockJournal& operator=(const DirtyBlockJournal&) = delete;
+
+    DirtyJournalHeader& header() { return *static_cast<DirtyJournalHeader*>(base); }
+    void* region() { return static_cast<char*>(base) + header_bytes; }
+    Recovery recovery() const { return recovery_state; }
+
+    // Flushes the region, then the header, to stable storage. Safe to call
+    // while the background thread checkpoints.
+    void checkpoint();
+
+private:
+    void run_checkpoints();
+
+    int fd = -1;
+    void* base = nullptr;
+    size_t mapped_bytes = 0;
+    Recovery recovery_state = Recovery::Created;
+
+    std::mutex checkpoint_mutex; // Serializes checkpoint()
+
+    std::chrono::milliseconds interval;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running = true;
+    std::thread worker;
+};
@@ -0,0 +1,97 @@
+#include "kernel_ring.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+[[noreturn]] void throw_ring_error(const std::string& what, const std::string& path) {
+    throw std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+} // namespace
+
+KernelRingReader::KernelRingReader(const std::string& device_path) {
+    fd = open(device_path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        throw_ring_error("Failed to open kernel event ring", device_path);
+    }
+
+    // The layout is only known once the info page has been read.
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    void* info_page = mmap(nullptr, page, PROT_READ, MAP_SHARED, fd, 0);
+    if (info_page == MAP_FAILED) {
+        close(fd);
+        throw_ring_error("Failed to map kernel event ring", device_path);
+    }
+    std::memcpy(&info, info_page, sizeof(info));
+    munmap(info_page, page);
+    if (info.magic != CORESTATE_RING_MAGIC || info.version != CORESTATE_RING_VERSION ||
+        info.capacity == 0 || (info.capacity & (info.capacity - 1)) != 0) {
+        close(fd);
+        throw std::runtime_error("Unsupported kernel event ring layout: " + device_path);
+    }
+
+    void* mapped = mmap(nullptr, info.map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        throw_ring_error("Failed to map kernel event ring", device_path);
+    }
+    base = static_cast<char*>(mapped);
+
+    efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd < 0 || ioctl(fd, CORESTATE_RING_IOC_SET_EVENTFD, &efd) != 0) {
+        int error = errno;
+        if (efd >= 0) {
+            close(efd);
+        }
+        munmap(base, info.map_bytes);
+        close(fd);
+        errno = error;
+        throw_ring_error("Failed to register eventfd with", device_path);
+    }
+}
+
+KernelRingReader::~KernelRingReader() {
+    // Closing the device also unregisters the eventfd.
+    munmap(base, info.map_bytes);
+    close(fd);
+    close(efd);
+}
+
+bool KernelRingReader::wait(int timeout_ms) {
+    pollfd pfd{fd, POLLIN, 0};
+    while (true) {
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready > 0) {
+            return true;
+        }
+        if (ready == 0) {
+            return false;
+        }
+        if (errno != EINTR) {
+            throw std::runtime_error(std::string("Failed to wait for kernel events: ") + std::strerror(errno));
+        }
+    }
+}
+
+void KernelRingReader::clear_event() {
+    uint64_t count;
+    while (read(efd, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+}
+
+uint64_t KernelRingReader::dropped() const {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < info.ring_count; ++i) {
+        total += __atomic_load_n(&header(i).dropped, __ATOMIC_RELAXED);
+    }
+    return total;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "corestate_ring.h"
+
+// --- Kernel Event Ring ---
+
+// Consumer side of the kernel module's per-CPU write rings. The rings are
+// mapped once, so draining them is plain memory reads with no syscall or
+// parsing per event; the only syscalls are the waits between batches, and
+// the module signals those only when a ring goes from empty to non-empty.
+//
+// There is one consumer per device: the module refuses a second open.
+class KernelRingReader {
+public:
+    explicit KernelRingReader(const std::string& device_path = CORESTATE_RING_DEVICE);
+    ~KernelRingReader();
+
+    KernelRingReader(const KernelRingReader&) = delete;
+    KernelRingReader& operator=(const KernelRingReader&) = delete;
+
+    // Passes pending records to fn(const corestate_ring_record* records,
+    // size_t count) in contiguous runs, ring by ring, releasing each run
+    // back to the module once fn returns; fn must copy anything it keeps.
+    // Each ring is drained until it is seen empty after its tail was
+    // released, so a record the module published mid-drain is either
+    // picked up here or signalled afresh. Stops after max_records and
+    // returns the number consumed; when that is max_records, records may
+    // be left that no signal will announce, so call again.
+    template<typename Fn>
+    size_t drain(Fn&& fn, size_t max_records = SIZE_MAX) {
+        size_t consumed = 0;
+        for (uint32_t i = 0; i < info.ring_count && consumed < max_records; ++i) {
+            corestate_ring_header& ring = header(i);
+            const corestate_ring_record* records = ring_records(i);
+            uint64_t tail = ring.tail;
+            while (consumed < max_records) {
+                uint64_t head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+                if (head == tail) {
+                    break;
+                }
+                size_t slot = static_cast<size_t>(tail & (info.capacity - 1));
+                size_t count = static_cast<size_t>(std::min<uint64_t>(head - tail, info.capacity - slot));
+                count = std::min(count, max_records - consumed);
+                fn(records + slot, count);
+                tail += count;
+                consumed += count;
+                __atomic_store_n(&ring.tail, tail, __ATOMIC_RELEASE);
+                // Pairs with the barrier in the module's push: either the
+                // next head load sees its record, or it sees this tail
+                // and signals.
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            }
+        }
+        return consumed;
+    }
+
+    // Blocks until some ring holds records, or timeout_ms passes (-1 waits
+    // forever). Returns false on timeout.
+    bool wait(int timeout_ms);
+
+    // Eventfd the module signals alongside poll wakeups, for callers that
+    // multiplex the feed in their own epoll loop. Call clear_event() after
+    // it fires, then drain until drain() returns less than max_records.
+    int event_fd() const { return efd; }
+    void clear_event();
+
+    // Records the module dropped because a ring was full. A change means
+    // writes were missed and the tracker must fall back to a full scan.
+    uint64_t dropped() const;
+
+    uint32_t ring_count() const { return info.ring_count; }
+
+private:
+    corestate_ring_header& header(uint32_t ring) const {
+        return *reinterpret_cast<corestate_ring_header*>(base + info.ring_offset + ring * info.ring_stride);
+    }
+
+    const corestate_ring_record* ring_records(uint32_t ring) const {
+        return reinterpret_cast<const corestate_ring_record*>(base + info.ring_offset + ring * info.ring_stride +
+                                                              info.records_offset);
+    }
+
+    int fd = -1;
+    int efd = -1;
+    char* base = nullptr;
+    corestate_ring_info info{};
+};
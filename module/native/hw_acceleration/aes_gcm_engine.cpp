@@ -0,0 +1,505 @@
+#include "aes_gcm_engine.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CORESTATE_GCM_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#include <arm_neon.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#define CORESTATE_GCM_ARM 1
+#endif
+
+namespace {
+
+// Blocks in flight per round, which hides AES instruction latency. GHASH
+// over the same blocks is aggregated with H^1..H^lanes and reduced once.
+constexpr int lanes = 8;
+
+// Clears key material before the memory is freed.
+void wipe(void* data, size_t size) {
+    volatile uint8_t* bytes = static_cast<volatile uint8_t*>(data);
+    while (size--) {
+        *bytes++ = 0;
+    }
+}
+
+bool tags_equal(const uint8_t* a, const uint8_t* b) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < AesGcmCipher::tag_bytes; ++i) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+// --- x86-64: AES-NI + PCLMULQDQ ---
+
+#ifdef CORESTATE_GCM_X86
+
+#define CORESTATE_AESNI __attribute__((target("aes,pclmul,ssse3,sse4.1")))
+
+// GHASH runs on byte-reversed blocks so PCLMULQDQ sees GCM's bit-reflected
+// polynomials in natural order.
+class AesNiGcm final : public AesGcmCipher {
+public:
+    CORESTATE_AESNI explicit AesNiGcm(const uint8_t* key) {
+        expand_key(key);
+        __m128i h = bswap(encrypt_block(_mm_setzero_si128()));
+        h_powers[0] = h;
+        for (int i = 1; i < lanes; ++i) {
+            h_powers[i] = gfmul(h_powers[i - 1], h);
+        }
+    }
+
+    ~AesNiGcm() override {
+        wipe(round_keys, sizeof(round_keys));
+        wipe(h_powers, sizeof(h_powers));
+    }
+
+    CORESTATE_AESNI void seal(const uint8_t* iv, const uint8_t* aad, size_t aad_len,
+                              const uint8_t* in, size_t size, uint8_t* out, uint8_t* tag) const override {
+        crypt(iv, aad, aad_len, in, size, out, tag, true);
+    }
+
+    CORESTATE_AESNI bool open(const uint8_t* iv, const uint8_t* aad, size_t aad_len,
+                              const uint8_t* in, size_t size, uint8_t* out, const uint8_t* tag) const override {
+        uint8_t expected[tag_bytes];
+        crypt(iv, aad, aad_len, in, size, out, expected, false);
+        if (tags_equal(expected, tag)) {
+            return true;
+        }
+        std::memset(out, 0, size);
+        return false;
+    }
+
+    const char* name() const override { return "aes-ni"; }
+
+private:
+    struct Wide {
+        __m128i lo, hi;
+    };
+
+    CORESTATE_AESNI static __m128i bswap(__m128i v) {
+        return _mm_shuffle_epi8(v, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    }
+
+    CORESTATE_AESNI static __m128i load(const uint8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    CORESTATE_AESNI static void store(uint8_t* p, __m128i v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+
+    CORESTATE_AESNI static __m128i counter_block(__m128i base, uint32_t counter) {
+        return _mm_insert_epi32(base, static_cast<int>(__builtin_bswap32(counter)), 3);
+    }
+
+    // --- Key schedule ---
+
+    CORESTATE_AESNI static __m128i spread(__m128i key) {
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+        return _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    }
+
+    CORESTATE_AESNI static __m128i expand_even(__m128i key, __m128i assist) {
+        return _mm_xor_si128(spread(key), _mm_shuffle_epi32(assist, 0xff));
+    }
+
+    CORESTATE_AESNI static __m128i expand_odd(__m128i key, __m128i even) {
+        return _mm_xor_si128(spread(key), _mm_shuffle_epi32(_mm_aeskeygenassist_si128(even, 0), 0xaa));
+    }
+
+    CORESTATE_AESNI void expand_key(const uint8_t* key) {
+        __m128i* rk = round_keys;
+        rk[0] = load(key);
+        rk[1] = load(key + 16);
+        rk[2] = expand_even(rk[0], _mm_aeskeygenassist_si128(rk[1], 0x01));
+        rk[3] = expand_odd(rk[1], rk[2]);
+        rk[4] = expand_even(rk[2], _mm_aeskeygenassist_si128(rk[3], 0x02));
+        rk[5] = expand_odd(rk[3], rk[4]);
+        rk[6] = expand_even(rk[4], _mm_aeskeygenassist_si128(rk[5], 0x04));
+        rk[7] = expand_odd(rk[5], rk[6]);
+        rk[8] = expand_even(rk[6], _mm_aeskeygenassist_si128(rk[7], 0x08));
+        rk[9] = expand_odd(rk[7], rk[8]);
+        rk[10] = expand_even(rk[8], _mm_aeskeygenassist_si128(rk[9], 0x10));
+        rk[11] = expand_odd(rk[9], rk[10]);
+        rk[12] = expand_even(rk[10], _mm_aeskeygenassist_si128(rk[11], 0x20));
+        rk[13] = expand_odd(rk[11], rk[12]);
+        rk[14] = expand_even(rk[12], _mm_aeskeygenassist_si128(rk[13], 0x40));
+    }
+
+    // --- AES ---
+
+    CORESTATE_AESNI __m128i encrypt_block(__m128i block) const {
+        block = _mm_xor_si128(block, round_keys[0]);
+        for (int round = 1; round < 14; ++round) {
+            block = _mm_aesenc_si128(block, round_keys[round]);
+        }
+        return _mm_aesenclast_si128(block, round_keys[14]);
+    }
+
+    CORESTATE_AESNI void encrypt_lanes(__m128i* blocks) const {
+        for (int i = 0; i < lanes; ++i) {
+            blocks[i] = _mm_xor_si128(blocks[i], round_keys[0]);
+        }
+        for (int round = 1; round < 14; ++round) {
+            for (int i = 0; i < lanes; ++i) {
+                blocks[i] = _mm_aesenc_si128(blocks[i], round_keys[round]);
+            }
+        }
+        for (int i = 0; i < lanes; ++i) {
+            blocks[i] = _mm_aesenclast_si128(blocks[i], round_keys[14]);
+        }
+    }
+
+    // --- GHASH ---
+
+    // 256-bit carry-less product, not yet reduced; sums of these reduce once.
+    CORESTATE_AESNI static Wide mul_wide(__m128i a, __m128i b) {
+        __m128i lo = _mm_clmulepi64_si128(a, b, 0x00);
+        __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+        __m128i hi = _mm_clmulepi64_si128(a, b, 0x11);
+        return Wide{_mm_xor_si128(lo, _mm_slli_si128(mid, 8)), _mm_xor_si128(hi, _mm_srli_si128(mid, 8))};
+    }
+
+    // Shifts the reflected product left one bit, then reduces it modulo
+    // x^128 + x^7 + x^2 + x + 1.
+    CORESTATE_AESNI static __m128i reduce(Wide w) {
+        __m128i lo = w.lo;
+        __m128i hi = w.hi;
+        __m128i lo_carry = _mm_srli_epi32(lo, 31);
+        __m128i hi_carry = _mm_srli_epi32(hi, 31);
+        lo = _mm_slli_epi32(lo, 1);
+        hi = _mm_slli_epi32(hi, 1);
+        __m128i cross = _mm_srli_si128(lo_carry, 12);
+        lo = _mm_or_si128(lo, _mm_slli_si128(lo_carry, 4));
+        hi = _mm_or_si128(hi, _mm_or_si128(_mm_slli_si128(hi_carry, 4), cross));
+
+        __m128i a = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+        __m128i a_high = _mm_srli_si128(a, 4);
+        lo = _mm_xor_si128(lo, _mm_slli_si128(a, 12));
+        __m128i b = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+        b = _mm_xor_si128(b, a_high);
+        lo = _mm_xor_si128(lo, b);
+        return _mm_xor_si128(hi, lo);
+    }
+
+    CORESTATE_AESNI static __m128i gfmul(__m128i a, __m128i b) { return reduce(mul_wide(a, b)); }
+
+    // Folds lanes blocks (already byte-reversed) into `y`.
+    CORESTATE_AESNI __m128i ghash_lanes(__m128i y, const __m128i* blocks) const {
+        Wide acc = mul_wide(_mm_xor_si128(y, blocks[0]), h_powers[lanes - 1]);
+        for (int i = 1; i < lanes; ++i) {
+            Wide product = mul_wide(blocks[i], h_powers[lanes - 1 - i]);
+            acc.lo = _mm_xor_si128(acc.lo, product.lo);
+            acc.hi = _mm_xor_si128(acc.hi, product.hi);
+        }
+        return reduce(acc);
+    }
+
+    CORESTATE_AESNI __m128i ghash_bytes(__m128i y, const uint8_t* data, size_t size) const {
+        for (; size >= 16; data += 16, size -= 16) {
+            y = gfmul(_mm_xor_si128(y, bswap(load(data))), h_powers[0]);
+        }
+        if (size) {
+            uint8_t block[16] = {};
+            std::memcpy(block, data, size);
+            y = gfmul(_mm_xor_si128(y, bswap(load(block))), h_powers[0]);
+        }
+        return y;
+    }
+
+    // --- GCM ---
+
+    CORESTATE_AESNI void crypt(const uint8_t* iv, const uint8_t* aad, size_t aad_len, const uint8_t* in,
+                               size_t size, uint8_t* out, uint8_t* tag, bool encrypt) const {
+        uint8_t iv_block[16] = {};
+        std::memcpy(iv_block, iv, iv_bytes);
+        const __m128i base = load(iv_block);
+        uint32_t counter = 2; // Counter 1 masks the tag
+        __m128i y = ghash_bytes(_mm_setzero_si128(), aad, aad_len);
+
+        size_t done = 0;
+        for (; size - done >= lanes * 16; done += lanes * 16) {
+            __m128i keystream[lanes];
+            for (int i = 0; i < lanes; ++i) {
+                keystream[i] = counter_block(base, counter + i);
+            }
+            counter += lanes;
+            encrypt_lanes(keystream);
+
+            __m128i ciphertext[lanes];
+            for (int i = 0; i < lanes; ++i) {
+                __m128i data = load(in + done + 16 * i);
+                __m128i result = _mm_xor_si128(data, keystream[i]);
+                store(out + done + 16 * i, result);
+                ciphertext[i] = bswap(encrypt ? result : data);
+            }
+            y = ghash_lanes(y, ciphertext);
+        }
+        for (; size - done >= 16; done += 16) {
+            __m128i data = load(in + done);
+            __m128i result = _mm_xor_si128(data, encrypt_block(counter_block(base, counter++)));
+            store(out + done, result);
+            y = gfmul(_mm_xor_si128(y, bswap(encrypt ? result : data)), h_powers[0]);
+        }
+        if (done < size) {
+            size_t tail = size - done;
+            uint8_t data[16] = {};
+            uint8_t result[16];
+            std::memcpy(data, in + done, tail);
+            store(result, _mm_xor_si128(load(data), encrypt_block(counter_block(base, counter))));
+            std::memcpy(out + done, result, tail);
+            std::memset(result + tail, 0, sizeof(result) - tail);
+            y = gfmul(_mm_xor_si128(y, bswap(load(encrypt ? result : data))), h_powers[0]);
+        }
+
+        __m128i lengths = _mm_set_epi64x(static_cast<long long>(aad_len * 8), static_cast<long long>(size * 8));
+        y = gfmul(_mm_xor_si128(y, lengths), h_powers[0]);
+        store(tag, _mm_xor_si128(bswap(y), encrypt_block(counter_block(base, 1))));
+    }
+
+    __m128i round_keys[15];
+    __m128i h_powers[lanes]; // H^(i + 1), byte-reversed
+};
+
+#endif // CORESTATE_GCM_X86
+
+// --- AArch64: ARMv8 crypto extensions ---
+
+#ifdef CORESTATE_GCM_ARM
+
+// GHASH runs on bit-reversed bytes, which turns GCM's reflected polynomials
+// into plain little-endian ones for PMULL.
+class ArmCeGcm final : public AesGcmCipher {
+public:
+    explicit ArmCeGcm(const uint8_t* key) {
+        expand_key(key);
+        uint8x16_t h = vrbitq_u8(encrypt_block(vdupq_n_u8(0)));
+        h_powers[0] = h;
+        for (int i = 1; i < lanes; ++i) {
+            h_powers[i] = gfmul(h_powers[i - 1], h);
+        }
+    }
+
+    ~ArmCeGcm() override {
+        wipe(round_keys, sizeof(round_keys));
+        wipe(h_powers, sizeof(h_powers));
+    }
+
+    void seal(const uint8_t* iv, const uint8_t* aad, size_t aad_len,
+              const uint8_t* in, size_t size, uint8_t* out, uint8_t* tag) const override {
+        crypt(iv, aad, aad_len, in, size, out, tag, true);
+    }
+
+    bool open(const uint8_t* iv, const uint8_t* aad, size_t aad_len,
+              const uint8_t* in, size_t size, uint8_t* out, const uint8_t* tag) const override {
+        uint8_t expected[tag_bytes];
+        crypt(iv, aad, aad_len, in, size, out, expected, false);
+        if (tags_equal(expected, tag)) {
+            return true;
+        }
+        std::memset(out, 0, size);
+        return false;
+    }
+
+    const char* name() const override { return "armv8-ce"; }
+
+private:
+    struct Wide {
+        uint8x16_t hi, mid, lo;
+    };
+
+    static uint8x16_t counter_block(uint8x16_t base, uint32_t counter) {
+        return vreinterpretq_u8_u32(vsetq_lane_u32(__builtin_bswap32(counter), vreinterpretq_u32_u8(base), 3));
+    }
+
+    // --- Key schedule ---
+
+    // SubWord through AESE with a zero round key: with the word in every
+    // column, ShiftRows leaves it in place.
+    static uint32_t sub_word(uint32_t word) {
+        uint8x16_t v = vaeseq_u8(vreinterpretq_u8_u32(vdupq_n_u32(word)), vdupq_n_u8(0));
+        return vgetq_lane_u32(vreinterpretq_u32_u8(v), 0);
+    }
+
+    void expand_key(const uint8_t* key) {
+        static const uint8_t rcon[7] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40};
+        uint32_t words[60];
+        std::memcpy(words, key, key_bytes);
+        for (int i = 8; i < 60; ++i) {
+            uint32_t word = words[i - 1];
+            if (i % 8 == 0) {
+                word = sub_word((word >> 8) | (word << 24)) ^ rcon[i / 8 - 1];
+            } else if (i % 8 == 4) {
+                word = sub_word(word);
+            }
+            words[i] = words[i - 8] ^ word;
+        }
+        for (int round = 0; round < 15; ++round) {
+            round_keys[round] = vld1q_u8(reinterpret_cast<const uint8_t*>(words + 4 * round));
+        }
+        wipe(words, sizeof(words));
+    }
+
+    // --- AES ---
+
+    uint8x16_t encrypt_block(uint8x16_t block) const {
+        for (int round = 0; round < 13; ++round) {
+            block = vaesmcq_u8(vaeseq_u8(block, round_keys[round]));
+        }
+        return veorq_u8(vaeseq_u8(block, round_keys[13]), round_keys[14]);
+    }
+
+    void encrypt_lanes(uint8x16_t* blocks) const {
+        for (int round = 0; round < 13; ++round) {
+            for (int i = 0; i < lanes; ++i) {
+                blocks[i] = vaesmcq_u8(vaeseq_u8(blocks[i], round_keys[round]));
+            }
+        }
+        for (int i = 0; i < lanes; ++i) {
+            blocks[i] = veorq_u8(vaeseq_u8(blocks[i], round_keys[13]), round_keys[14]);
+        }
+    }
+
+    // --- GHASH ---
+
+    static uint8x16_t pmull_low(uint8x16_t a, uint8x16_t b) {
+        return vreinterpretq_u8_p128(vmull_p64(vgetq_lane_p64(vreinterpretq_p64_u8(a), 0),
+                                               vgetq_lane_p64(vreinterpretq_p64_u8(b), 0)));
+    }
+
+    static uint8x16_t pmull_high(uint8x16_t a, uint8x16_t b) {
+        return vreinterpretq_u8_p128(vmull_high_p64(vreinterpretq_p64_u8(a), vreinterpretq_p64_u8(b)));
+    }
+
+    // Product as high (bits 128..255), middle (64..191) and low (0..127) parts.
+    static Wide mul_wide(uint8x16_t a, uint8x16_t b) {
+        uint8x16_t swapped = vextq_u8(b, b, 8);
+        return Wide{pmull_high(a, b), veorq_u8(pmull_high(a, swapped), pmull_low(a, swapped)), pmull_low(a, b)};
+    }
+
+    // Folds each part above bit 128 back down by x^128 = x^7 + x^2 + x + 1.
+    static uint8x16_t reduce(Wide w) {
+        const uint8x16_t modulus = vreinterpretq_u8_u64(vdupq_n_u64(0x87));
+        uint8x16_t mid = veorq_u8(pmull_high(w.hi, modulus), w.mid);
+        uint8x16_t low = veorq_u8(pmull_low(w.hi, modulus), w.lo);
+        low = veorq_u8(low, pmull_high(mid, modulus));
+        return veorq_u8(low, vextq_u8(vdupq_n_u8(0), mid, 8));
+    }
+
+    static uint8x16_t gfmul(uint8x16_t a, uint8x16_t b) { return reduce(mul_wide(a, b)); }
+
+    // Folds lanes blocks (already bit-reversed) into `y`.
+    uint8x16_t ghash_lanes(uint8x16_t y, const uint8x16_t* blocks) const {
+        Wide acc = mul_wide(veorq_u8(y, blocks[0]), h_powers[lanes - 1]);
+        for (int i = 1; i < lanes; ++i) {
+            Wide product = mul_wide(blocks[i], h_powers[lanes - 1 - i]);
+            acc.hi = veorq_u8(acc.hi, product.hi);
+            acc.mid = veorq_u8(acc.mid, product.mid);
+            acc.lo = veorq_u8(acc.lo, product.lo);
+        }
+        return reduce(acc);
+    }
+
+    uint8x16_t ghash_bytes(uint8x16_t y, const uint8_t* data, size_t size) const {
+        for (; size >= 16; data += 16, size -= 16) {
+            y = gfmul(veorq_u8(y, vrbitq_u8(vld1q_u8(data))), h_powers[0]);
+        }
+        if (size) {
+            uint8_t block[16] = {};
+            std::memcpy(block, data, size);
+            y = gfmul(veorq_u8(y, vrbitq_u8(vld1q_u8(block))), h_powers[0]);
+        }
+        return y;
+    }
+
+    // --- GCM ---
+
+    void crypt(const uint8_t* iv, const uint8_t* aad, size_t aad_len, const uint8_t* in,
+               size_t size, uint8_t* out, uint8_t* tag, bool encrypt) const {
+        uint8_t iv_block[16] = {};
+        std::memcpy(iv_block, iv, iv_bytes);
+        const uint8x16_t base = vld1q_u8(iv_block);
+        uint32_t counter = 2; // Counter 1 masks the tag
+        uint8x16_t y = ghash_bytes(vdupq_n_u8(0), aad, aad_len);
+
+        size_t done = 0;
+        for (; size - done >= lanes * 16; done += lanes * 16) {
+            uint8x16_t keystream[lanes];
+            for (int i = 0; i < lanes; ++i) {
+                keystream[i] = counter_block(base, counter + i);
+            }
+            counter += lanes;
+            encrypt_lanes(keystream);
+
+            uint8x16_t ciphertext[lanes];
+            for (int i = 0; i < lanes; ++i) {
+                uint8x16_t data = vld1q_u8(in + done + 16 * i);
+                uint8x16_t result = veorq_u8(data, keystream[i]);
+                vst1q_u8(out + done + 16 * i, result);
+                ciphertext[i] = vrbitq_u8(encrypt ? result : data);
+            }
+            y = ghash_lanes(y, ciphertext);
+        }
+        for (; size - done >= 16; done += 16) {
+            uint8x16_t data = vld1q_u8(in + done);
+            uint8x16_t result = veorq_u8(data, encrypt_block(counter_block(base, counter++)));
+            vst1q_u8(out + done, result);
+            y = gfmul(veorq_u8(y, vrbitq_u8(encrypt ? result : data)), h_powers[0]);
+        }
+        if (done < size) {
+            size_t tail = size - done;
+            uint8_t data[16] = {};
+            uint8_t result[16];
+            std::memcpy(data, in + done, tail);
+            vst1q_u8(result, veorq_u8(vld1q_u8(data), encrypt_block(counter_block(base, counter))));
+            std::memcpy(out + done, result, tail);
+            std::memset(result + tail, 0, sizeof(result) - tail);
+            y = gfmul(veorq_u8(y, vrbitq_u8(vld1q_u8(encrypt ? result : data))), h_powers[0]);
+        }
+
+        uint64_t bits[2] = {__builtin_bswap64(uint64_t(aad_len) * 8), __builtin_bswap64(uint64_t(size) * 8)};
+        y = gfmul(veorq_u8(y, vrbitq_u8(vreinterpretq_u8_u64(vld1q_u64(bits)))), h_powers[0]);
+        vst1q_u8(tag, veorq_u8(vrbitq_u8(y), encrypt_block(counter_block(base, 1))));
+    }
+
+    uint8x16_t round_keys[15];
+    uint8x16_t h_powers[lanes]; // H^(i + 1), bit-reversed
+};
+
+#endif // CORESTATE_GCM_ARM
+
+} // namespace
+
+bool AesGcmCipher::cpu_supported() {
+#if defined(CORESTATE_GCM_X86)
+    static const bool supported = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul") &&
+               __builtin_cpu_supports("sse4.1");
+    }();
+    return supported;
+#elif defined(CORESTATE_GCM_ARM)
+    static const bool supported = [] {
+        unsigned long hwcap = getauxval(AT_HWCAP);
+        return (hwcap & HWCAP_AES) && (hwcap & HWCAP_PMULL);
+    }();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+std::unique_ptr<AesGcmCipher> AesGcmCipher::create(const uint8_t* key) {
+    if (!cpu_supported()) {
+        return nullptr;
+    }
+#if defined(CORESTATE_GCM_X86)
+    return std::unique_ptr<AesGcmCipher>(new AesNiGcm(key));
+#elif defined(CORESTATE_GCM_ARM)
+    return std::unique_ptr<AesGcmCipher>(new ArmCeGcm(key));
+#else
+    (void)key;
+    return nullptr;
+#endif
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// --- AES-256-GCM Engine ---
+
+// Bulk AES-256-GCM on the CPU's AES instructions: AES-NI with PCLMULQDQ on
+// x86-64, the ARMv8 crypto extensions on AArch64. A cipher holds one expanded
+// key and is immutable once created, so any number of threads may seal or
+// open chunks with it at the same time.
+class AesGcmCipher {
+public:
+    static constexpr size_t key_bytes = 32;
+    static constexpr size_t iv_bytes = 12;
+    static constexpr size_t tag_bytes = 16;
+
+    virtual ~AesGcmCipher() = default;
+
+    // Encrypts `size` bytes of `in` into `out` (which may alias `in`) and
+    // writes the tag. `iv` is iv_bytes long and must never repeat for a key.
+    virtual void seal(const uint8_t* iv, const uint8_t* aad, size_t aad_len,
+                      const uint8_t* in, size_t size, uint8_t* out, uint8_t* tag) const = 0;
+
+    // Decrypts and verifies. On a tag mismatch returns false and zeroes `out`.
+    virtual bool open(const uint8_t* iv, const uint8_t* aad, size_t aad_len,
+                      const uint8_t* in, size_t size, uint8_t* out, const uint8_t* tag) const = 0;
+
+    virtual const char* name() const = 0;
+
+    // Whether this CPU has the instructions create() needs.
+    static bool cpu_supported();
+
+    // Expands a key_bytes key, or returns nullptr when !cpu_supported().
+    static std::unique_ptr<AesGcmCipher> create(const uint8_t* key);
+};
@@ -1,38 +1,12 @@
-#include <iostream>
-#include <vector>
-#include <string>
-#include <mutex>
-#include <future>
-
-// --- Placeholder PKCS#11 API Definitions ---
-// These would be provided by the actual PKCS#11 header (pkcs11.h)
-
-using CK_RV = unsigned long;
-using CK_SESSION_HANDLE = unsigned long;
-using CK_OBJECT_HANDLE = unsigned long;
-using CK_MECHANISM_TYPE = unsigned long;
-
-#define CKR_OK 0
-#define CKM_SHA256_HMAC_GENERAL 0x1051 // Example value
-#define CKA_CLASS 0x0000
-#define CKA_KEY_TYPE 0x0100
-#define CKA_DERIVE 0x0104
-#define CKA_SENSITIVE 0x0103
-#define CKA_EXTRACTABLE 0x0102
-
-struct CK_MECHANISM {
-    CK_MECHANISM_TYPE mechanism;
-    void* pParameter;
-    unsigned long ulParameterLen;
-};
-
-struct CK_ATTRIBUTE {
-    unsigned long type;
-    void* pValue;
-    unsigned long ulValueLen;
-};
+#include "hsm_integration.h"
 
 // Mock PKCS#11 functions
+CK_RV C_OpenSession(CK_SLOT_ID slotID, CK_FLAGS flags, void* pApplication, void* Notify, CK_SESSION_HANDLE* phSession) {
+    static std::atomic<CK_SESSION_HANDLE> next_session{1};
+    *phSession = next_session++;
+    return CKR_OK;
+}
+CK_RV C_CloseSession(CK_SESSION_HANDLE hSession) { return CKR_OK; }
 CK_RV C_DeriveKey(CK_SESSION_HANDLE hSession, CK_MECHANISM* pMechanism, CK_OBJECT_HANDLE hBaseKey, CK_ATTRIBUTE* pTemplate, unsigned long ulAttributeCount, CK_OBJECT_HANDLE* phKey) {
     *phKey = 12345; // Return a dummy handle
     return CKR_OK;
@@ -45,114 +19,36 @@ CK_RV C_Encrypt(CK_SESSION_HANDLE hSession, unsigned char* pData, unsigned long
     for(unsigned long i = 0; i < ulDataLen; ++i) pEncryptedData[i] = pData[i] ^ 0xAB;
     return CKR_OK;
 }
+CK_RV C_EncryptUpdate(CK_SESSION_HANDLE hSession, unsigned char* pPart, unsigned long ulPartLen, unsigned char* pEncryptedPart, unsigned long* pulEncryptedPartLen) {
+    *pulEncryptedPartLen = ulPartLen;
+    for(unsigned long i = 0; i < ulPartLen; ++i) pEncryptedPart[i] = pPart[i] ^ 0xAB;
+    return CKR_OK;
+}
+CK_RV C_EncryptFinal(CK_SESSION_HANDLE hSession, unsigned char* pLastEncryptedPart, unsigned long* pulLastEncryptedPartLen) {
+    *pulLastEncryptedPartLen = 0;
+    return CKR_OK;
+}
 
-class HSMException : public std::exception {
-public:
-    HSMException(const char* msg) : message(msg) {}
-    const char* what() const noexcept override { return message; }
-private:
-    const char* message;
-};
-
-// --- Main HSMIntegration Class ---
-
-class HSMIntegration {
-private:
-    // PKCS11_CTX* pkcs11_ctx; // This would be a context from a real library
-    CK_SESSION_HANDLE session = 1; // Mock session handle
-    std::mutex hsm_mutex;
-    
-public:
-    class MasterKeyManager {
-        CK_OBJECT_HANDLE master_key_handle = 100; // Mock master key handle
-        HSMIntegration& parent;
-
-    public:
-        MasterKeyManager(HSMIntegration& p) : parent(p) {}
-
-        std::vector<uint8_t> derive_backup_key(const std::string& backup_id) {
-            std::lock_guard<std::mutex> lock(parent.hsm_mutex);
-            
-            CK_MECHANISM mechanism = {
-                CKM_SHA256_HMAC_GENERAL,
-                (void*)backup_id.c_str(),
-                (unsigned long)backup_id.length()
-            };
-            
-            CK_OBJECT_HANDLE derived_key;
-            // Dummy attributes
-            unsigned long key_class, key_type;
-            bool true_val = true, false_val = false;
-            CK_ATTRIBUTE key_template[] = {
-                {CKA_CLASS, &key_class, sizeof(key_class)},
-                {CKA_KEY_TYPE, &key_type, sizeof(key_type)},
-                {CKA_DERIVE, &true_val, sizeof(true_val)},
-                {CKA_SENSITIVE, &true_val, sizeof(true_val)},
-                {CKA_EXTRACTABLE, &false_val, sizeof(false_val)}
-            };
-            
-            CK_RV rv = C_DeriveKey(
-                parent.session, &mechanism, master_key_handle,
-                key_template, 5, &derived_key
-            );
-            
-            if (rv != CKR_OK) {
-                throw HSMException("Failed to derive backup key");
-            }
-            
-            // In a real scenario, you'd return a wrapped/encrypted key handle
-            std::vector<uint8_t> key_handle_bytes(sizeof(derived_key));
-            memcpy(key_handle_bytes.data(), &derived_key, sizeof(derived_key));
-            return key_handle_bytes;
-        }
-        
-        void rotate_master_key() {
-            std::lock_guard<std::mutex> lock(parent.hsm_mutex);
-            CK_OBJECT_HANDLE new_master_key = 200; // Generate new mock key
-            // reencrypt_all_keys(master_key_handle, new_master_key); // Placeholder
-            CK_OBJECT_HANDLE old_key = master_key_handle;
-            master_key_handle = new_master_key;
-            C_DestroyObject(parent.session, old_key);
-        }
-    };
-    
-    class CryptoAccelerator {
-        HSMIntegration& parent;
-    public:
-        struct AESContext {
-            CK_OBJECT_HANDLE key_handle;
-            CK_MECHANISM_TYPE mechanism;
-            std::vector<uint8_t> iv;
-        };
-        
-        CryptoAccelerator(HSMIntegration& p) : parent(p) {}
-
-        std::future<std::vector<uint8_t>> encrypt_async(
-            const std::vector<uint8_t>& data,
-            const AESContext& context
-        ) {
-            return std::async(std::launch::async, [this, data, context]() {
-                std::lock_guard<std::mutex> lock(parent.hsm_mutex);
-                
-                CK_MECHANISM mechanism = {
-                    context.mechanism,
-                    (void*)context.iv.data(),
-                    (unsigned long)context.iv.size()
-                };
-                
-                C_EncryptInit(parent.session, &mechanism, context.key_handle);
-                
-                unsigned long encrypted_len = (unsigned long)data.size() + 16;
-                std::vector<uint8_t> encrypted(encrypted_len);
-                
-                C_Encrypt(
-                    parent.session, (unsigned char*)data.data(), (unsigned long)data.size(),
-                    encrypted.data(), &encrypted_len
-                );
-                
-                encrypted.resize(encrypted_len);
-                return encrypted;
-            });
-        }
-    };
-};
\ No newline at end of file
+CK_RV C_DecryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM* pMechanism, CK_OBJECT_HANDLE hKey) { return CKR_OK; }
+CK_RV C_Decrypt(CK_SESSION_HANDLE hSession, unsigned char* pEncryptedData, unsigned long ulEncryptedDataLen, unsigned char* pData, unsigned long* pulDataLen) {
+    *pulDataLen = ulEncryptedDataLen;
+    for(unsigned long i = 0; i < ulEncryptedDataLen; ++i) pData[i] = pEncryptedData[i] ^ 0xAB;
+    return CKR_OK;
+}
+CK_RV C_UnwrapKey(CK_SESSION_HANDLE hSession, CK_MECHANISM* pMechanism, CK_OBJECT_HANDLE hUnwrappingKey, unsigned char* pWrappedKey, unsigned long ulWrappedKeyLen, CK_ATTRIBUTE* pTemplate, unsigned long ulAttributeCount, CK_OBJECT_HANDLE* phKey) {
+    *phKey = 23456; // Return a dummy handle
+    return CKR_OK;
+}
+CK_RV C_WrapKey(CK_SESSION_HANDLE hSession, CK_MECHANISM* pMechanism, CK_OBJECT_HANDLE hWrappingKey, CK_OBJECT_HANDLE hKey, unsigned char* pWrappedKey, unsigned long* pulWrappedKeyLen) {
+    for(unsigned long i = 0; i < *pulWrappedKeyLen; ++i) pWrappedKey[i] = (unsigned char)(hWrappingKey + i);
+    return CKR_OK;
+}
+CK_RV C_GenerateKey(CK_SESSION_HANDLE hSession, CK_MECHANISM* pMechanism, CK_ATTRIBUTE* pTemplate, unsigned long ulCount, CK_OBJECT_HANDLE* phKey) {
+    static std::atomic<CK_OBJECT_HANDLE> next_key{200};
+    *phKey = next_key++;
+    return CKR_OK;
+}
+CK_RV C_GenerateRandom(CK_SESSION_HANDLE hSession, unsigned char* pRandomData, unsigned long ulRandomLen) {
+    for(unsigned long i = 0; i < ulRandomLen; ++i) pRandomData[i] = (unsigned char)(i * 37 + 11);
+    return CKR_OK;
+}
\ No newline at end of file
@@ -0,0 +1,1310 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <deque>
+#include <thread>
+#include <exception>
+#include <memory>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include "aes_gcm_engine.h"
+#include "latency_histogram.h"
+
+// --- Placeholder PKCS#11 API Definitions ---
+// These would be provided by the actual PKCS#11 header (pkcs11.h)
+
+using CK_RV = unsigned long;
+using CK_SESSION_HANDLE = unsigned long;
+using CK_OBJECT_HANDLE = unsigned long;
+using CK_MECHANISM_TYPE = unsigned long;
+using CK_SLOT_ID = unsigned long;
+using CK_FLAGS = unsigned long;
+
+#define CKR_OK 0
+#define CKR_BUFFER_TOO_SMALL 0x0150
+#define CKF_RW_SESSION 0x0002
+#define CKF_SERIAL_SESSION 0x0004
+#define CKM_SHA256_HMAC_GENERAL 0x1051 // Example value
+#define CKM_AES_KEY_GEN 0x1080
+#define CKM_AES_GCM 0x1087
+#define CKM_AES_KEY_WRAP_PAD 0x210A
+#define CKO_SECRET_KEY 0x0004
+#define CKK_AES 0x001F
+#define CKA_CLASS 0x0000
+#define CKA_KEY_TYPE 0x0100
+#define CKA_DERIVE 0x010C
+#define CKA_SENSITIVE 0x0103
+#define CKA_EXTRACTABLE 0x0102
+#define CKA_ENCRYPT 0x0104
+#define CKA_WRAP 0x0106
+#define CKA_UNWRAP 0x0107
+
+struct CK_MECHANISM {
+    CK_MECHANISM_TYPE mechanism;
+    void* pParameter;
+    unsigned long ulParameterLen;
+};
+
+struct CK_ATTRIBUTE {
+    unsigned long type;
+    void* pValue;
+    unsigned long ulValueLen;
+};
+
+// PKCS#11 entry points; hsm_integration.cpp defines mocks for them.
+CK_RV C_OpenSession(CK_SLOT_ID slotID, CK_FLAGS flags, void* pApplication, void* Notify, CK_SESSION_HANDLE* phSession);
+CK_RV C_CloseSession(CK_SESSION_HANDLE hSession);
+CK_RV C_DeriveKey(CK_SESSION_HANDLE hSession, CK_MECHANISM* pMechanism, CK_OBJECT_HANDLE hBaseKey, CK_ATTRIBUTE* pTemplate, unsigned long ulAttributeCount, CK_OBJECT_HANDLE* phKey);
+CK_RV C_DestroyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject);
+CK_RV C_EncryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM* pMechanism, CK_OBJECT_HANDLE hKey);
+CK_RV C_Encrypt(CK_SESSION_HANDLE hSession, unsigned char* pData, unsigned long ulDataLen, unsigned char* pEncryptedData, unsigned long* pulEncryptedDataLen);
+CK_RV C_EncryptUpdate(CK_SESSION_HANDLE hSession, unsigned char* pPart, unsigned long ulPartLen, unsigned char* pEncryptedPart, unsigned long* pulEncryptedPartLen);
+CK_RV C_EncryptFinal(CK_SESSION_HANDLE hSession, unsigned char* pLastEncryptedPart, unsigned long* pulLastEncryptedPartLen);
+CK_RV C_DecryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM* pMechanism, CK_OBJECT_HANDLE hKey);
+CK_RV C_Decrypt(CK_SESSION_HANDLE hSession, unsigned char* pEncryptedData, unsigned long ulEncryptedDataLen, unsigned char* pData, unsigned long* pulDataLen);
+CK_RV C_UnwrapKey(CK_SESSION_HANDLE hSession, CK_MECHANISM* pMechanism, CK_OBJECT_HANDLE hUnwrappingKey, unsigned char* pWrappedKey, unsigned long ulWrappedKeyLen, CK_ATTRIBUTE* pTemplate, unsigned long ulAttributeCount, CK_OBJECT_HANDLE* phKey);
+CK_RV C_WrapKey(CK_SESSION_HANDLE hSession, CK_MECHANISM* pMechanism, CK_OBJECT_HANDLE hWrappingKey, CK_OBJECT_HANDLE hKey, unsigned char* pWrappedKey, unsigned long* pulWrappedKeyLen);
+CK_RV C_GenerateKey(CK_SESSION_HANDLE hSession, CK_MECHANISM* pMechanism, CK_ATTRIBUTE* pTemplate, unsigned long ulCount, CK_OBJECT_HANDLE* phKey);
+CK_RV C_GenerateRandom(CK_SESSION_HANDLE hSession, unsigned char* pRandomData, unsigned long ulRandomLen);
+
+class HSMException : public std::exception {
+public:
+    HSMException(const char* msg) : message(msg) {}
+    const char* what() const noexcept override { return message; }
+private:
+    const char* message;
+};
+
+// --- Main HSMIntegration Class ---
+
+class HSMIntegration {
+private:
+    // PKCS11_CTX* pkcs11_ctx; // This would be a context from a real library
+
+    // PKCS#11 sessions are single-threaded, so each concurrent operation
+    // checks one out for its duration instead of every call serializing on
+    // one session. Size the pool to the HSM's crypto cores; callers beyond
+    // that wait for a session to come back.
+    class SessionPool {
+    public:
+        SessionPool(CK_SLOT_ID s, size_t size) : slot(s) {
+            if (size == 0) {
+                throw HSMException("HSM session pool needs at least one session");
+            }
+            for (size_t i = 0; i < size; ++i) {
+                CK_SESSION_HANDLE session;
+                if (C_OpenSession(slot, CKF_SERIAL_SESSION | CKF_RW_SESSION, nullptr, nullptr, &session) != CKR_OK) {
+                    close_all();
+                    throw HSMException("Failed to open HSM session");
+                }
+                all.push_back(session);
+            }
+            idle = all;
+        }
+
+        ~SessionPool() { close_all(); }
+
+        SessionPool(const SessionPool&) = delete;
+        SessionPool& operator=(const SessionPool&) = delete;
+
+        CK_SESSION_HANDLE checkout() {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock, [this] { return !idle.empty(); });
+            CK_SESSION_HANDLE session = idle.back();
+            idle.pop_back();
+            return session;
+        }
+
+        void give_back(CK_SESSION_HANDLE session) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                idle.push_back(session);
+            }
+            available.notify_one();
+        }
+
+        // Closes a session left in an unknown state, such as one with an
+        // operation the HSM would not end, and pools a fresh one in its
+        // place. The pool shrinks by one if no new session can be opened.
+        void replace(CK_SESSION_HANDLE broken) {
+            C_CloseSession(broken);
+            CK_SESSION_HANDLE fresh;
+            bool opened = C_OpenSession(slot, CKF_SERIAL_SESSION | CKF_RW_SESSION, nullptr, nullptr, &fresh) == CKR_OK;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = std::find(all.begin(), all.end(), broken);
+                if (opened) {
+                    *it = fresh;
+                    idle.push_back(fresh);
+                } else {
+                    all.erase(it);
+                }
+            }
+            if (opened) {
+                available.notify_one();
+            }
+        }
+
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return all.size();
+        }
+
+    private:
+        void close_all() {
+            for (CK_SESSION_HANDLE session : all) {
+                C_CloseSession(session);
+            }
+            all.clear();
+        }
+
+        const CK_SLOT_ID slot;
+        std::vector<CK_SESSION_HANDLE> all;
+        mutable std::mutex mutex;
+        std::condition_variable available;
+        std::vector<CK_SESSION_HANDLE> idle;
+    };
+
+    // Holds a pooled session for one scope.
+    class SessionLease {
+    public:
+        explicit SessionLease(SessionPool& p) : pool(p), session(p.checkout()) {}
+
+        ~SessionLease() {
+            if (broken) {
+                pool.replace(session);
+            } else {
+                pool.give_back(session);
+            }
+        }
+
+        SessionLease(const SessionLease&) = delete;
+        SessionLease& operator=(const SessionLease&) = delete;
+
+        CK_SESSION_HANDLE handle() const { return session; }
+
+        // Closes the session on release instead of pooling it again.
+        void discard() { broken = true; }
+
+    private:
+        SessionPool& pool;
+        CK_SESSION_HANDLE session;
+        bool broken = false;
+    };
+
+    SessionPool sessions;
+    std::shared_mutex master_key_mutex; // Rotation excludes derivations in flight
+
+public:
+    explicit HSMIntegration(size_t session_count = 4, CK_SLOT_ID slot = 0)
+        : sessions(slot, session_count) {}
+
+    size_t session_count() const { return sessions.size(); }
+
+    // Master keys are numbered by generation. Rotation switches new work to
+    // a fresh generation at once and re-wraps existing key material on a
+    // throttled background thread; the old generation stays usable until
+    // every record has moved, then it is destroyed.
+    //
+    // Derived keys are cached per (master key generation, backup_id) so a
+    // restore walking a chain of incrementals derives each key once. Entries
+    // expire after `cache_ttl` and the least recently used is dropped past
+    // `cache_capacity`; a retired generation's entries are purged with it.
+    // Callers get a DerivedKeyLease sharing the key object with the cache,
+    // so an entry going only drops the cache's reference and the object is
+    // destroyed in the HSM once the last lease is released.
+    class MasterKeyManager {
+        std::map<uint64_t, CK_OBJECT_HANDLE> master_keys{{0, 100}}; // Mock master key handle
+        HSMIntegration& parent;
+
+    public:
+        // A derived key object in the HSM. Must not outlive the HSMIntegration.
+        class DerivedKey {
+        public:
+            ~DerivedKey() {
+                if (key) {
+                    SessionLease session(hsm.sessions);
+                    C_DestroyObject(session.handle(), key);
+                }
+            }
+
+            DerivedKey(const DerivedKey&) = delete;
+            DerivedKey& operator=(const DerivedKey&) = delete;
+
+            CK_OBJECT_HANDLE handle() const { return key; }
+
+            // In a real scenario, you'd return a wrapped/encrypted key handle
+            std::vector<uint8_t> bytes() const {
+                std::vector<uint8_t> bytes(sizeof(key));
+                memcpy(bytes.data(), &key, sizeof(key));
+                return bytes;
+            }
+
+        private:
+            friend class MasterKeyManager;
+
+            explicit DerivedKey(HSMIntegration& h) : hsm(h) {}
+
+            HSMIntegration& hsm;
+            CK_OBJECT_HANDLE key = 0;
+        };
+
+        using DerivedKeyLease = std::shared_ptr<const DerivedKey>;
+
+        // Key material wrapped under one master key generation.
+        struct WrappedKeyRecord {
+            std::string id;
+            uint64_t generation;
+            std::vector<uint8_t> blob;
+        };
+
+        // Receives each record once it is wrapped under the new generation,
+        // for the caller to persist. Runs on the rotation thread.
+        using RewrapSink = std::function<void(const WrappedKeyRecord& record)>;
+
+        struct RotationOptions {
+            size_t batch_size = 64;                    // Records re-wrapped per session checkout
+            std::chrono::milliseconds batch_pause{10}; // Idle time between batches
+        };
+
+        struct RotationStatus {
+            bool in_progress;
+            uint64_t from_generation;
+            uint64_t to_generation;
+            size_t rewrapped;
+            size_t total;
+        };
+
+        MasterKeyManager(HSMIntegration& p, size_t cache_capacity = 1024,
+                          std::chrono::steady_clock::duration cache_ttl = std::chrono::minutes(5))
+            : parent(p), capacity(cache_capacity), ttl(cache_ttl) {}
+
+        // Stops a rotation in progress; every generation stays valid.
+        ~MasterKeyManager() {
+            {
+                std::lock_guard<std::mutex> lock(rotation_mutex);
+                cancel_rotation = true;
+            }
+            rotation_wake.notify_all();
+            if (rotation_worker.joinable()) {
+                rotation_worker.join();
+            }
+        }
+
+        MasterKeyManager(const MasterKeyManager&) = delete;
+        MasterKeyManager& operator=(const MasterKeyManager&) = delete;
+
+        uint64_t current_generation() const {
+            std::shared_lock<std::shared_mutex> key_lock(parent.master_key_mutex);
+            return generation;
+        }
+
+        DerivedKeyLease derive_backup_key(const std::string& backup_id) {
+            std::vector<DerivedKeyLease> dropped; // Released after the key lock
+            std::shared_lock<std::shared_mutex> key_lock(parent.master_key_mutex);
+            return derive_locked(backup_id, generation, dropped);
+        }
+
+        // Derives under an older generation, e.g. for a backup whose key
+        // material has not been re-wrapped yet. Throws once it is retired.
+        DerivedKeyLease derive_backup_key(const std::string& backup_id, uint64_t key_generation) {
+            std::vector<DerivedKeyLease> dropped;
+            std::shared_lock<std::shared_mutex> key_lock(parent.master_key_mutex);
+            return derive_locked(backup_id, key_generation, dropped);
+        }
+
+        // Switches to a new master key generation and returns it. `records`
+        // are re-wrapped in the background from whichever live generation
+        // holds them, and every older generation keeps serving requests
+        // until that finishes and retires them all. A rotation that failed
+        // leaves its old generation live, so retrying with the same records
+        // also moves the ones it did not reach. Throws if a rotation is
+        // already running.
+        uint64_t start_key_rotation(std::vector<WrappedKeyRecord> records, RewrapSink sink) {
+            return start_key_rotation(std::move(records), std::move(sink), RotationOptions());
+        }
+
+        uint64_t start_key_rotation(std::vector<WrappedKeyRecord> records, RewrapSink sink,
+                                    RotationOptions options) {
+            std::lock_guard<std::mutex> lock(rotation_mutex);
+            if (rotation_active) {
+                throw HSMException("Master key rotation already in progress");
+            }
+            if (rotation_worker.joinable()) {
+                rotation_worker.join();
+            }
+            CK_OBJECT_HANDLE new_master_key = generate_master_key();
+
+            std::unique_lock<std::shared_mutex> key_lock(parent.master_key_mutex);
+            rotation_from = generation;
+            rotation_to = generation + 1;
+            master_keys.emplace(rotation_to, new_master_key);
+            generation = rotation_to;
+            key_lock.unlock();
+
+            rotation_active = true;
+            rotation_error = nullptr;
+            rotation_total = records.size();
+            rewrapped.store(0, std::memory_order_relaxed);
+            rotation_worker = std::thread(&MasterKeyManager::rewrap_loop, this, std::move(records),
+                                          std::move(sink), options, rotation_to);
+            return rotation_to;
+        }
+
+        RotationStatus rotation_status() {
+            std::lock_guard<std::mutex> lock(rotation_mutex);
+            return RotationStatus{rotation_active, rotation_from, rotation_to,
+                                  rewrapped.load(std::memory_order_relaxed), rotation_total};
+        }
+
+        // Blocks until the running rotation retires the old generations, and
+        // rethrows if re-wrapping failed (they then stay).
+        void wait_for_rotation() {
+            std::unique_lock<std::mutex> lock(rotation_mutex);
+            rotation_wake.wait(lock, [this] { return !rotation_active; });
+            if (rotation_error) {
+                std::rethrow_exception(rotation_error);
+            }
+        }
+
+        // Rotates with nothing to re-wrap and waits for it.
+        void rotate_master_key() {
+            start_key_rotation({}, nullptr);
+            wait_for_rotation();
+        }
+
+        uint64_t cache_hits() const { return hits.load(std::memory_order_relaxed); }
+        
+        uint64_t cache_misses() const { return misses.load(std::memory_order_relaxed); }
+
+        size_t cache_size() {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            return index.size();
+        }
+
+    private:
+        // Caller holds master_key_mutex shared. Leases the cache lets go of
+        // are moved to `dropped`, for the caller to release once unlocked.
+        DerivedKeyLease derive_locked(const std::string& backup_id, uint64_t key_generation,
+                                      std::vector<DerivedKeyLease>& dropped) {
+            auto master = master_keys.find(key_generation);
+            if (master == master_keys.end()) {
+                throw HSMException("Master key generation is not available");
+            }
+            CacheKey key{key_generation, backup_id};
+            DerivedKeyLease derived;
+            if (cache_lookup(key, derived, dropped)) {
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return derived;
+            }
+            misses.fetch_add(1, std::memory_order_relaxed);
+
+            std::shared_ptr<DerivedKey> fresh(new DerivedKey(parent));
+            fresh->key = derive_key(master->second, backup_id);
+            return cache_insert(std::move(key), std::move(fresh), dropped);
+        }
+
+        CK_OBJECT_HANDLE derive_key(CK_OBJECT_HANDLE master_key, const std::string& backup_id) {
+            SessionLease session(parent.sessions);
+            
+            CK_MECHANISM mechanism = {
+                CKM_SHA256_HMAC_GENERAL,
+                (void*)backup_id.c_str(),
+                (unsigned long)backup_id.length()
+            };
+            
+            CK_OBJECT_HANDLE derived_key;
+            // Dummy attributes
+            unsigned long key_class, key_type;
+            bool true_val = true, false_val = false;
+            CK_ATTRIBUTE key_template[] = {
+                {CKA_CLASS, &key_class, sizeof(key_class)},
+                {CKA_KEY_TYPE, &key_type, sizeof(key_type)},
+                {CKA_DERIVE, &true_val, sizeof(true_val)},
+                {CKA_SENSITIVE, &true_val, sizeof(true_val)},
+                {CKA_EXTRACTABLE, &false_val, sizeof(false_val)}
+            };
+            
+            CK_RV rv = C_DeriveKey(
+                session.handle(), &mechanism, master_key,
+                key_template, 5, &derived_key
+            );
+            
+            if (rv != CKR_OK) {
+                throw HSMException("Failed to derive backup key");
+            }
+            return derived_key;
+        }
+
+        // Leases its own session, so callers must not hold one.
+        void destroy_keys(const std::vector<CK_OBJECT_HANDLE>& keys) {
+            if (keys.empty()) {
+                return;
+            }
+            SessionLease session(parent.sessions);
+            for (CK_OBJECT_HANDLE key : keys) {
+                C_DestroyObject(session.handle(), key);
+            }
+        }
+
+        CK_OBJECT_HANDLE generate_master_key() {
+            SessionLease session(parent.sessions);
+            CK_MECHANISM mechanism = {CKM_AES_KEY_GEN, nullptr, 0};
+            unsigned long key_class = CKO_SECRET_KEY, key_type = CKK_AES;
+            bool true_val = true, false_val = false;
+            CK_ATTRIBUTE key_template[] = {
+                {CKA_CLASS, &key_class, sizeof(key_class)},
+                {CKA_KEY_TYPE, &key_type, sizeof(key_type)},
+                {CKA_DERIVE, &true_val, sizeof(true_val)},
+                {CKA_WRAP, &true_val, sizeof(true_val)},
+                {CKA_UNWRAP, &true_val, sizeof(true_val)},
+                {CKA_SENSITIVE, &true_val, sizeof(true_val)},
+                {CKA_EXTRACTABLE, &false_val, sizeof(false_val)}
+            };
+            CK_OBJECT_HANDLE key;
+            if (C_GenerateKey(session.handle(), &mechanism, key_template, 7, &key) != CKR_OK) {
+                throw HSMException("Failed to generate master key");
+            }
+            return key;
+        }
+
+        // Moves one wrapped key from `old_key` to `new_key` inside the HSM;
+        // the plaintext never leaves it.
+        static std::vector<uint8_t> rewrap(CK_SESSION_HANDLE session, CK_OBJECT_HANDLE old_key,
+                                           CK_OBJECT_HANDLE new_key, const std::vector<uint8_t>& blob) {
+            CK_MECHANISM mechanism = {CKM_AES_KEY_WRAP_PAD, nullptr, 0};
+            unsigned long key_class = CKO_SECRET_KEY, key_type = CKK_AES;
+            bool true_val = true;
+            CK_ATTRIBUTE key_template[] = {
+                {CKA_CLASS, &key_class, sizeof(key_class)},
+                {CKA_KEY_TYPE, &key_type, sizeof(key_type)},
+                {CKA_SENSITIVE, &true_val, sizeof(true_val)},
+                {CKA_EXTRACTABLE, &true_val, sizeof(true_val)}
+            };
+            CK_OBJECT_HANDLE key;
+            if (C_UnwrapKey(session, &mechanism, old_key, (unsigned char*)blob.data(), (unsigned long)blob.size(),
+                            key_template, 4, &key) != CKR_OK) {
+                throw HSMException("Failed to unwrap key for rotation");
+            }
+            std::vector<uint8_t> wrapped(blob.size() + 16);
+            unsigned long wrapped_len = (unsigned long)wrapped.size();
+            CK_RV rv = C_WrapKey(session, &mechanism, new_key, key, wrapped.data(), &wrapped_len);
+            C_DestroyObject(session, key);
+            if (rv != CKR_OK) {
+                throw HSMException("Failed to wrap key for rotation");
+            }
+            wrapped.resize(wrapped_len);
+            return wrapped;
+        }
+
+        void rewrap_loop(std::vector<WrappedKeyRecord> records, RewrapSink sink, RotationOptions options, uint64_t to) {
+            std::exception_ptr error;
+            try {
+                // Only this thread retires generations, so the copy stays valid.
+                std::map<uint64_t, CK_OBJECT_HANDLE> keys;
+                {
+                    std::shared_lock<std::shared_mutex> key_lock(parent.master_key_mutex);
+                    keys = master_keys;
+                }
+                CK_OBJECT_HANDLE new_key = keys.at(to);
+                bool cancelled = false;
+                const size_t batch = std::max<size_t>(1, options.batch_size);
+                for (size_t begin = 0; begin < records.size(); begin += batch) {
+                    if (begin && pause(options.batch_pause)) {
+                        cancelled = true; // Every generation stays
+                        break;
+                    }
+                    size_t end = std::min(records.size(), begin + batch);
+                    SessionLease session(parent.sessions);
+                    for (size_t i = begin; i < end; ++i) {
+                        WrappedKeyRecord& record = records[i];
+                        if (record.generation != to) {
+                            auto old_key = keys.find(record.generation);
+                            if (old_key == keys.end()) {
+                                throw HSMException("Key record is under a retired master key generation");
+                            }
+                            record.blob = rewrap(session.handle(), old_key->second, new_key, record.blob);
+                            record.generation = to;
+                        }
+                        if (sink) {
+                            sink(record);
+                        }
+                    }
+                    rewrapped.fetch_add(end - begin, std::memory_order_relaxed);
+                }
+                if (!cancelled) {
+                    for (const auto& [old_generation, key] : keys) {
+                        if (old_generation < to) {
+                            retire_generation(old_generation);
+                        }
+                    }
+                }
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(rotation_mutex);
+                rotation_active = false;
+                rotation_error = error;
+            }
+            rotation_wake.notify_all();
+        }
+
+        // Sleeps between batches; returns true if the manager is shutting down.
+        bool pause(std::chrono::milliseconds duration) {
+            std::unique_lock<std::mutex> lock(rotation_mutex);
+            return rotation_wake.wait_for(lock, duration, [this] { return cancel_rotation; });
+        }
+
+        // Unhooks the generation under the locks and destroys its objects
+        // after releasing them, since that needs a session and derivations
+        // wait for one while holding master_key_mutex shared.
+        void retire_generation(uint64_t old_generation) {
+            std::vector<DerivedKeyLease> purged;
+            std::unique_lock<std::shared_mutex> key_lock(parent.master_key_mutex);
+            CK_OBJECT_HANDLE master_key = master_keys.at(old_generation);
+            master_keys.erase(old_generation);
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                for (auto it = lru.begin(); it != lru.end();) {
+                    if (it->key.generation == old_generation) {
+                        purged.push_back(std::move(it->derived));
+                        index.erase(it->key);
+                        it = lru.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            key_lock.unlock();
+            destroy_keys({master_key});
+            purged.clear();
+        }
+
+        struct CacheKey {
+            uint64_t generation;
+            std::string backup_id;
+
+            bool operator==(const CacheKey& other) const {
+                return generation == other.generation && backup_id == other.backup_id;
+            }
+        };
+
+        struct CacheKeyHash {
+            size_t operator()(const CacheKey& key) const {
+                return std::hash<std::string>()(key.backup_id) ^ (key.generation * 0x9E3779B97F4A7C15ull);
+            }
+        };
+
+        struct CacheEntry {
+            CacheKey key;
+            DerivedKeyLease derived;
+            std::chrono::steady_clock::time_point expires;
+        };
+
+        using LruList = std::list<CacheEntry>; // Most recently used first
+
+        // Leases of dropped entries go to `dropped`, so a key object the
+        // cache held last is not destroyed under cache_mutex.
+        bool cache_lookup(const CacheKey& key, DerivedKeyLease& out, std::vector<DerivedKeyLease>& dropped) {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            auto it = index.find(key);
+            if (it == index.end()) {
+                return false;
+            }
+            if (std::chrono::steady_clock::now() >= it->second->expires) {
+                dropped.push_back(std::move(it->second->derived));
+                lru.erase(it->second);
+                index.erase(it);
+                return false;
+            }
+            lru.splice(lru.begin(), lru, it->second);
+            out = it->second->derived;
+            return true;
+        }
+
+        // Returns the lease to hand out, which is the cached one if another
+        // caller derived the same key concurrently.
+        DerivedKeyLease cache_insert(CacheKey&& key, DerivedKeyLease derived, std::vector<DerivedKeyLease>& dropped) {
+            if (!capacity) {
+                return derived;
+            }
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            auto it = index.find(key);
+            if (it != index.end()) {
+                // Keep the entry other callers may already be using
+                dropped.push_back(std::move(derived));
+                lru.splice(lru.begin(), lru, it->second);
+                return it->second->derived;
+            }
+            if (index.size() >= capacity) {
+                dropped.push_back(std::move(lru.back().derived));
+                index.erase(lru.back().key);
+                lru.pop_back();
+            }
+            lru.push_front(CacheEntry{std::move(key), derived, std::chrono::steady_clock::now() + ttl});
+            index.emplace(lru.front().key, lru.begin());
+            return derived;
+        }
+
+        const size_t capacity;
+        const std::chrono::steady_clock::duration ttl;
+        uint64_t generation = 0; // Written only under the exclusive key lock
+
+        std::mutex rotation_mutex;
+        std::condition_variable rotation_wake;
+        std::thread rotation_worker;
+        bool rotation_active = false;
+        bool cancel_rotation = false;
+        std::exception_ptr rotation_error;
+        uint64_t rotation_from = 0;
+        uint64_t rotation_to = 0;
+        size_t rotation_total = 0;
+        std::atomic<size_t> rewrapped{0};
+
+        std::mutex cache_mutex;
+        LruList lru;
+        std::unordered_map<CacheKey, LruList::iterator, CacheKeyHash> index;
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+    
+    // Encrypts chunks on a fixed pool of workers, one per HSM session by
+    // default, fed from a bounded queue. Buffers are taken by value so
+    // callers can move plaintext in without a copy; submissions block once
+    // queue_capacity jobs are waiting, which pushes back on producers
+    // instead of buffering unbounded plaintext.
+    class CryptoAccelerator {
+    public:
+        // Slack an encryption may add beyond its input (one block).
+        static constexpr size_t block_overhead = 16;
+
+        struct AESContext {
+            CK_OBJECT_HANDLE key_handle;
+            CK_MECHANISM_TYPE mechanism;
+            std::vector<uint8_t> iv;
+        };
+
+        // Receives the ciphertext, or a non-null error if encryption failed.
+        using EncryptCallback = std::function<void(std::vector<uint8_t>&& encrypted, std::exception_ptr error)>;
+
+        explicit CryptoAccelerator(HSMIntegration& p, size_t workers = 0, size_t queue_capacity = 64)
+            : parent(p), capacity(std::max<size_t>(1, queue_capacity)) {
+            if (!workers) {
+                workers = parent.session_count();
+            }
+            for (size_t i = 0; i < workers; ++i) {
+                pool.emplace_back(&CryptoAccelerator::worker_loop, this);
+            }
+        }
+
+        // Finishes every queued job before returning.
+        ~CryptoAccelerator() {
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                stopping = true;
+            }
+            not_empty.notify_all();
+            for (auto& worker : pool) {
+                worker.join();
+            }
+        }
+
+        CryptoAccelerator(const CryptoAccelerator&) = delete;
+        CryptoAccelerator& operator=(const CryptoAccelerator&) = delete;
+
+        std::future<std::vector<uint8_t>> encrypt_async(std::vector<uint8_t> data, AESContext context) {
+            Job job{std::move(data), std::move(context), {}, {}};
+            std::future<std::vector<uint8_t>> result = job.promise.get_future();
+            submit(std::move(job));
+            return result;
+        }
+
+        // Callback form; `done` runs on a worker thread.
+        void encrypt_async(std::vector<uint8_t> data, AESContext context, EncryptCallback done) {
+            submit(Job{std::move(data), std::move(context), {}, std::move(done)});
+        }
+
+        // One chunk of a batch. `data` and `iv` are borrowed for the call.
+        struct BatchChunk {
+            const uint8_t* data;
+            size_t size;
+            const uint8_t* iv;
+            size_t iv_len;
+        };
+
+        // Ciphertext of a batch packed back to back: chunk i occupies
+        // [offsets[i], offsets[i + 1]) of `arena`. Reuse one across calls to
+        // keep its storage.
+        struct EncryptedBatch {
+            std::vector<uint8_t> arena;
+            std::vector<size_t> offsets;
+
+            size_t count() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+            const uint8_t* chunk(size_t i) const { return arena.data() + offsets[i]; }
+            size_t chunk_size(size_t i) const { return offsets[i + 1] - offsets[i]; }
+        };
+
+        // Encrypts many small chunks under one key on a single session
+        // checkout, on the calling thread, writing into `out`'s arena sized
+        // once up front. Skips the queue, promise and allocation per chunk
+        // that encrypt_async pays, which dominate for 4-64 KiB dedup chunks.
+        void encrypt_batch(const BatchChunk* chunks, size_t count, CK_OBJECT_HANDLE key_handle,
+                           CK_MECHANISM_TYPE mechanism, EncryptedBatch& out) {
+            LatencyHistogram::Scope timing(batch_latency);
+            size_t reserve = 0;
+            for (size_t i = 0; i < count; ++i) {
+                reserve += chunks[i].size + block_overhead;
+            }
+            out.arena.resize(reserve);
+            out.offsets.resize(count + 1);
+            out.offsets[0] = 0;
+
+            SessionLease session(parent.sessions);
+            size_t used = 0;
+            for (size_t i = 0; i < count; ++i) {
+                const BatchChunk& chunk = chunks[i];
+                used += encrypt_into(session.handle(), key_handle, mechanism, chunk.iv, chunk.iv_len,
+                                     chunk.data, chunk.size, out.arena.data() + used, out.arena.size() - used);
+                out.offsets[i + 1] = used;
+            }
+            out.arena.resize(used);
+        }
+
+        EncryptedBatch encrypt_batch(const std::vector<BatchChunk>& chunks, CK_OBJECT_HANDLE key_handle,
+                                     CK_MECHANISM_TYPE mechanism) {
+            EncryptedBatch out;
+            encrypt_batch(chunks.data(), chunks.size(), key_handle, mechanism, out);
+            return out;
+        }
+
+        // One multi-part encryption kept open on a leased session: the key
+        // is initialized once, then C_EncryptUpdate runs per chunk into the
+        // caller's output buffer and C_EncryptFinal closes the operation.
+        // Memory stays at one output buffer however large the object is.
+        // The session is held until the stream is destroyed.
+        class StreamEncryptor {
+        public:
+            StreamEncryptor(HSMIntegration& hsm, const AESContext& context) : session(hsm.sessions) {
+                CK_MECHANISM mechanism = {
+                    context.mechanism,
+                    (void*)context.iv.data(),
+                    (unsigned long)context.iv.size()
+                };
+                if (C_EncryptInit(session.handle(), &mechanism, context.key_handle) != CKR_OK) {
+                    throw HSMException("Failed to initialize encryption");
+                }
+                active = true;
+            }
+
+            // Ends an unfinished operation so the session goes back clean,
+            // or closes the session if the HSM will not end it.
+            ~StreamEncryptor() {
+                if (active && !abort_operation()) {
+                    session.discard();
+                }
+            }
+
+            StreamEncryptor(const StreamEncryptor&) = delete;
+            StreamEncryptor& operator=(const StreamEncryptor&) = delete;
+
+            // Encrypts `size` bytes into `out` and returns the bytes written.
+            // `out_capacity` must be at least size + block_overhead.
+            size_t update(const uint8_t* data, size_t size, uint8_t* out, size_t out_capacity) {
+                if (!active) {
+                    throw HSMException("Encryption stream already finished");
+                }
+                if (out_capacity < size + block_overhead) {
+                    throw HSMException("Encryption output buffer too small");
+                }
+                unsigned long out_len = (unsigned long)out_capacity;
+                if (C_EncryptUpdate(session.handle(), (unsigned char*)data, (unsigned long)size, out, &out_len) != CKR_OK) {
+                    throw HSMException("Failed to encrypt data");
+                }
+                bytes_in += size;
+                bytes_out += out_len;
+                return out_len;
+            }
+
+            // Flushes the final block (and tag, for AEAD mechanisms).
+            size_t finish(uint8_t* out, size_t out_capacity) {
+                if (!active) {
+                    throw HSMException("Encryption stream already finished");
+                }
+                unsigned long out_len = (unsigned long)out_capacity;
+                CK_RV rv = C_EncryptFinal(session.handle(), out, &out_len);
+                active = rv == CKR_BUFFER_TOO_SMALL; // The operation stays open
+                if (rv != CKR_OK) {
+                    throw HSMException("Failed to finish encryption");
+                }
+                bytes_out += out_len;
+                return out_len;
+            }
+
+            // Pulls plaintext from `next(const uint8_t*& data, size_t& size)`
+            // until it returns false, encrypting each chunk into `out` and
+            // handing the ciphertext to `sink(const uint8_t*, size_t)` before
+            // reading on. Chunks larger than the buffer are split. Returns
+            // the total ciphertext size.
+            template<typename NextChunk, typename Sink>
+            uint64_t encrypt_stream(NextChunk&& next, uint8_t* out, size_t out_capacity, Sink&& sink) {
+                if (out_capacity <= block_overhead) {
+                    throw HSMException("Encryption output buffer too small");
+                }
+                const size_t max_piece = out_capacity - block_overhead;
+                const uint8_t* data;
+                size_t size;
+                while (next(data, size)) {
+                    while (size) {
+                        size_t piece = std::min(size, max_piece);
+                        size_t n = update(data, piece, out, out_capacity);
+                        if (n) {
+                            sink(static_cast<const uint8_t*>(out), n);
+                        }
+                        data += piece;
+                        size -= piece;
+                    }
+                }
+                size_t n = finish(out, out_capacity);
+                if (n) {
+                    sink(static_cast<const uint8_t*>(out), n);
+                }
+                return bytes_out;
+            }
+
+            uint64_t plaintext_bytes() const { return bytes_in; }
+            uint64_t ciphertext_bytes() const { return bytes_out; }
+
+        private:
+            // Finishes into a buffer of the size the HSM asks for, since one
+            // too small for what a mechanism holds back (GCM's tag and any
+            // buffered input) leaves the operation active.
+            bool abort_operation() noexcept {
+                unsigned long len = 0;
+                if (C_EncryptFinal(session.handle(), nullptr, &len) != CKR_OK) {
+                    return false;
+                }
+                try {
+                    std::vector<unsigned char> scratch(std::max<unsigned long>(len, 1));
+                    return C_EncryptFinal(session.handle(), scratch.data(), &len) == CKR_OK;
+                } catch (const std::bad_alloc&) {
+                    return false;
+                }
+            }
+
+            SessionLease session;
+            bool active = false;
+            uint64_t bytes_in = 0;
+            uint64_t bytes_out = 0;
+        };
+
+        std::unique_ptr<StreamEncryptor> begin_stream(const AESContext& context) {
+            return std::make_unique<StreamEncryptor>(parent, context);
+        }
+
+        struct Metrics {
+            LatencyHistogram::Snapshot encrypt_async; // Submission to result, queueing included
+            LatencyHistogram::Snapshot encrypt_batch;
+        };
+
+        Metrics metrics() const {
+            return {async_latency.snapshot(), batch_latency.snapshot()};
+        }
+
+        // Appends metrics() in the Prometheus text format for a scrape endpoint.
+        void append_metrics(std::string& out, const std::string& prefix = "corestate_crypto") const {
+            Metrics m = metrics();
+            append_prometheus(out, prefix + "_encrypt_async_seconds", m.encrypt_async);
+            append_prometheus(out, prefix + "_encrypt_batch_seconds", m.encrypt_batch);
+        }
+
+    private:
+        struct Job {
+            std::vector<uint8_t> data;
+            AESContext context;
+            std::promise<std::vector<uint8_t>> promise;
+            EncryptCallback callback; // Used instead of the promise when set
+            bool timed = false;
+            std::chrono::steady_clock::time_point submitted{};
+        };
+
+        void submit(Job&& job) {
+            job.timed = async_latency.begin();
+            if (job.timed) {
+                job.submitted = std::chrono::steady_clock::now();
+            }
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            not_full.wait(lock, [this] { return queue.size() < capacity; });
+            queue.push_back(std::move(job));
+            lock.unlock();
+            not_empty.notify_one();
+        }
+
+        void worker_loop() {
+            while (true) {
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(queue_mutex);
+                    not_empty.wait(lock, [this] { return stopping || !queue.empty(); });
+                    if (queue.empty()) {
+                        return;
+                    }
+                    job = std::move(queue.front());
+                    queue.pop_front();
+                }
+                not_full.notify_one();
+
+                std::vector<uint8_t> encrypted;
+                std::exception_ptr error;
+                try {
+                    encrypted = encrypt_chunk(job.data, job.context);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                if (job.timed) {
+                    async_latency.record(std::chrono::steady_clock::now() - job.submitted);
+                }
+                if (job.callback) {
+                    job.callback(std::move(encrypted), error);
+                } else if (error) {
+                    job.promise.set_exception(error);
+                } else {
+                    job.promise.set_value(std::move(encrypted));
+                }
+            }
+        }
+
+        // Single-part encryption of `size` bytes into `out` on a held
+        // session; returns the ciphertext length.
+        static size_t encrypt_into(CK_SESSION_HANDLE session, CK_OBJECT_HANDLE key_handle, CK_MECHANISM_TYPE type,
+                                   const uint8_t* iv, size_t iv_len, const uint8_t* data, size_t size,
+                                   uint8_t* out, size_t out_capacity) {
+            CK_MECHANISM mechanism = {type, (void*)iv, (unsigned long)iv_len};
+
+            if (C_EncryptInit(session, &mechanism, key_handle) != CKR_OK) {
+                throw HSMException("Failed to initialize encryption");
+            }
+
+            unsigned long encrypted_len = (unsigned long)out_capacity;
+            CK_RV rv = C_Encrypt(session, (unsigned char*)data, (unsigned long)size, out, &encrypted_len);
+            if (rv != CKR_OK) {
+                throw HSMException("Failed to encrypt data");
+            }
+            return encrypted_len;
+        }
+
+        std::vector<uint8_t> encrypt_chunk(const std::vector<uint8_t>& data, const AESContext& context) {
+            SessionLease session(parent.sessions);
+            std::vector<uint8_t> encrypted(data.size() + block_overhead);
+            encrypted.resize(encrypt_into(session.handle(), context.key_handle, context.mechanism,
+                                          context.iv.data(), context.iv.size(), data.data(), data.size(),
+                                          encrypted.data(), encrypted.size()));
+            return encrypted;
+        }
+
+        HSMIntegration& parent;
+        const size_t capacity;
+
+        std::mutex queue_mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+        std::deque<Job> queue;
+        bool stopping = false;
+        LatencyHistogram async_latency;
+        LatencyHistogram batch_latency;
+        std::vector<std::thread> pool; // Declared last so workers start after the state above
+    };
+
+    // Envelope encryption for bulk backup data. Each backup gets a random
+    // AES-256 data key that is only ever stored wrapped under a key-encryption
+    // key held in the HSM, so the HSM does one unwrap per backup instead of
+    // encrypting every byte. Chunks are then sealed with AES-GCM on the CPU,
+    // split between the calling thread and a fixed pool of helpers, or by
+    // the HSM through encrypt_batch for tenants pinned to it and on CPUs
+    // without AES instructions.
+    class BulkEncryptor {
+    public:
+        enum class Engine { Cpu, Hsm };
+
+        using BatchChunk = CryptoAccelerator::BatchChunk;
+        using EncryptedBatch = CryptoAccelerator::EncryptedBatch;
+
+        // Smallest share of a batch worth handing to another thread.
+        static constexpr size_t bytes_per_thread = 1 << 20;
+
+        // A data key unwrapped for the engine that will use it.
+        class DataKey {
+        public:
+            ~DataKey() {
+                if (handle) {
+                    SessionLease session(hsm.sessions);
+                    C_DestroyObject(session.handle(), handle);
+                }
+            }
+
+            DataKey(const DataKey&) = delete;
+            DataKey& operator=(const DataKey&) = delete;
+
+            Engine engine() const { return cipher ? Engine::Cpu : Engine::Hsm; }
+
+        private:
+            friend class BulkEncryptor;
+
+            explicit DataKey(HSMIntegration& h) : hsm(h) {}
+
+            HSMIntegration& hsm;
+            std::unique_ptr<AesGcmCipher> cipher; // CPU engine
+            CK_OBJECT_HANDLE handle = 0;          // HSM engine
+        };
+
+        // `threads` counts the calling thread, so threads - 1 helpers start.
+        BulkEncryptor(HSMIntegration& p, CryptoAccelerator& accelerator, size_t threads = 0)
+            : parent(p), hsm_path(accelerator),
+              threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+            try {
+                for (size_t i = 1; i < this->threads; ++i) {
+                    helpers.emplace_back(&BulkEncryptor::helper_loop, this);
+                }
+            } catch (...) {
+                stop_helpers();
+                throw;
+            }
+        }
+
+        ~BulkEncryptor() { stop_helpers(); }
+
+        BulkEncryptor(const BulkEncryptor&) = delete;
+        BulkEncryptor& operator=(const BulkEncryptor&) = delete;
+
+        // Tenants use the CPU engine unless pinned to the HSM here.
+        void set_tenant_engine(const std::string& tenant, Engine engine) {
+            std::unique_lock<std::shared_mutex> lock(tenants_mutex);
+            tenant_engines[tenant] = engine;
+        }
+
+        // The engine `tenant` actually gets; a CPU without AES instructions
+        // falls back to the HSM.
+        Engine tenant_engine(const std::string& tenant) const {
+            Engine engine = Engine::Cpu;
+            {
+                std::shared_lock<std::shared_mutex> lock(tenants_mutex);
+                auto it = tenant_engines.find(tenant);
+                if (it != tenant_engines.end()) {
+                    engine = it->second;
+                }
+            }
+            return engine == Engine::Cpu && !AesGcmCipher::cpu_supported() ? Engine::Hsm : engine;
+        }
+
+        // Draws a data key from the HSM's RNG and returns it wrapped under
+        // `kek`, for storing alongside the backup.
+        std::vector<uint8_t> create_data_key(CK_OBJECT_HANDLE kek) {
+            SessionLease session(parent.sessions);
+            uint8_t key[AesGcmCipher::key_bytes];
+            if (C_GenerateRandom(session.handle(), key, sizeof(key)) != CKR_OK) {
+                throw HSMException("Failed to generate data key");
+            }
+
+            CK_MECHANISM mechanism = {CKM_AES_KEY_WRAP_PAD, nullptr, 0};
+            std::vector<uint8_t> wrapped(sizeof(key) + 16);
+            unsigned long wrapped_len = (unsigned long)wrapped.size();
+            CK_RV rv = C_EncryptInit(session.handle(), &mechanism, kek);
+            if (rv == CKR_OK) {
+                rv = C_Encrypt(session.handle(), key, sizeof(key), wrapped.data(), &wrapped_len);
+            }
+            wipe(key, sizeof(key));
+            if (rv != CKR_OK) {
+                throw HSMException("Failed to wrap data key");
+            }
+            wrapped.resize(wrapped_len);
+            return wrapped;
+        }
+
+        // Unwraps a data key for `tenant`'s engine: into an expanded CPU key
+        // schedule, or as a non-extractable HSM object for the HSM engine.
+        std::unique_ptr<DataKey> unwrap_data_key(const std::string& tenant, CK_OBJECT_HANDLE kek,
+                                                 const std::vector<uint8_t>& wrapped) {
+            std::unique_ptr<DataKey> key(new DataKey(parent));
+            SessionLease session(parent.sessions); // Released before `key` on failure
+            CK_MECHANISM mechanism = {CKM_AES_KEY_WRAP_PAD, nullptr, 0};
+
+            if (tenant_engine(tenant) == Engine::Cpu) {
+                uint8_t plain[AesGcmCipher::key_bytes + 16];
+                unsigned long plain_len = sizeof(plain);
+                CK_RV rv = C_DecryptInit(session.handle(), &mechanism, kek);
+                if (rv == CKR_OK) {
+                    rv = C_Decrypt(session.handle(), (unsigned char*)wrapped.data(), (unsigned long)wrapped.size(),
+                                   plain, &plain_len);
+                }
+                if (rv == CKR_OK && plain_len == AesGcmCipher::key_bytes) {
+                    key->cipher = AesGcmCipher::create(plain);
+                }
+                wipe(plain, sizeof(plain));
+                if (!key->cipher) {
+                    throw HSMException("Failed to unwrap data key");
+                }
+                return key;
+            }
+
+            unsigned long key_class = CKO_SECRET_KEY, key_type = CKK_AES;
+            bool true_val = true, false_val = false;
+            CK_ATTRIBUTE key_template[] = {
+                {CKA_CLASS, &key_class, sizeof(key_class)},
+                {CKA_KEY_TYPE, &key_type, sizeof(key_type)},
+                {CKA_ENCRYPT, &true_val, sizeof(true_val)},
+                {CKA_SENSITIVE, &true_val, sizeof(true_val)},
+                {CKA_EXTRACTABLE, &false_val, sizeof(false_val)}
+            };
+            CK_RV rv = C_UnwrapKey(session.handle(), &mechanism, kek, (unsigned char*)wrapped.data(),
+                                   (unsigned long)wrapped.size(), key_template, 5, &key->handle);
+            if (rv != CKR_OK) {
+                throw HSMException("Failed to unwrap data key");
+            }
+            return key;
+        }
+
+        // Seals each chunk as its ciphertext followed by the GCM tag, packed
+        // into `out` like encrypt_batch. IVs must be 12 bytes and never
+        // repeat under one data key.
+        void seal_batch(const DataKey& key, const BatchChunk* chunks, size_t count, EncryptedBatch& out) {
+            if (!key.cipher) {
+                hsm_path.encrypt_batch(chunks, count, key.handle, CKM_AES_GCM, out);
+                return;
+            }
+
+            out.offsets.resize(count + 1);
+            out.offsets[0] = 0;
+            for (size_t i = 0; i < count; ++i) {
+                if (chunks[i].iv_len != AesGcmCipher::iv_bytes) {
+                    throw HSMException("AES-GCM chunk IV must be 12 bytes");
+                }
+                out.offsets[i + 1] = out.offsets[i] + chunks[i].size + AesGcmCipher::tag_bytes;
+            }
+            const size_t total = out.offsets[count];
+            out.arena.resize(total);
+
+            // Every chunk's place in the arena is known up front, so threads
+            // seal disjoint byte-balanced ranges with no coordination.
+            auto seal_range = [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    uint8_t* sealed = out.arena.data() + out.offsets[i];
+                    key.cipher->seal(chunks[i].iv, nullptr, 0, chunks[i].data, chunks[i].size,
+                                     sealed, sealed + chunks[i].size);
+                }
+            };
+            size_t workers = std::max<size_t>(1, std::min({threads, count, total / bytes_per_thread + 1}));
+            std::vector<size_t> bounds(workers + 1, count);
+            for (size_t w = 0; w < workers; ++w) {
+                bounds[w] = std::lower_bound(out.offsets.begin(), out.offsets.end() - 1, total / workers * w) -
+                            out.offsets.begin();
+            }
+            // Helpers borrow this frame, so wait for every range handed out
+            // even if handing out the next one throws.
+            struct WaitAll {
+                std::vector<std::future<void>> ranges;
+                ~WaitAll() {
+                    for (auto& range : ranges) {
+                        if (range.valid()) {
+                            range.wait();
+                        }
+                    }
+                }
+            } pending;
+            pending.ranges.reserve(workers - 1);
+            for (size_t w = 1; w < workers; ++w) {
+                pending.ranges.push_back(run_on_helper([&seal_range, begin = bounds[w], end = bounds[w + 1]] {
+                    seal_range(begin, end);
+                }));
+            }
+            seal_range(bounds[0], bounds[1]);
+            for (auto& range : pending.ranges) {
+                range.get();
+            }
+        }
+
+        // Verifies and decrypts chunk `index` of a CPU-sealed batch into
+        // `out`, which needs room for chunk_size(index) - tag_bytes bytes.
+        bool open_chunk(const DataKey& key, const EncryptedBatch& sealed, size_t index, const uint8_t* iv,
+                        uint8_t* out) const {
+            if (!key.cipher) {
+                throw HSMException("Data key is not bound to the CPU engine");
+            }
+            size_t size = sealed.chunk_size(index) - AesGcmCipher::tag_bytes;
+            const uint8_t* data = sealed.chunk(index);
+            return key.cipher->open(iv, nullptr, 0, data, size, out, data + size);
+        }
+
+    private:
+        static void wipe(void* data, size_t size) {
+            volatile uint8_t* bytes = static_cast<volatile uint8_t*>(data);
+            while (size--) {
+                *bytes++ = 0;
+            }
+        }
+
+        std::future<void> run_on_helper(std::function<void()> work) {
+            std::packaged_task<void()> task(std::move(work));
+            std::future<void> done = task.get_future();
+            {
+                std::lock_guard<std::mutex> lock(helper_mutex);
+                helper_tasks.push_back(std::move(task));
+            }
+            helper_wake.notify_one();
+            return done;
+        }
+
+        void helper_loop() {
+            while (true) {
+                std::packaged_task<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(helper_mutex);
+                    helper_wake.wait(lock, [this] { return helpers_stopping || !helper_tasks.empty(); });
+                    if (helper_tasks.empty()) {
+                        return;
+                    }
+                    task = std::move(helper_tasks.front());
+                    helper_tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+        void stop_helpers() {
+            {
+                std::lock_guard<std::mutex> lock(helper_mutex);
+                helpers_stopping = true;
+            }
+            helper_wake.notify_all();
+            for (auto& helper : helpers) {
+                helper.join();
+            }
+        }
+
+        HSMIntegration& parent;
+        CryptoAccelerator& hsm_path;
+        const size_t threads;
+
+        mutable std::shared_mutex tenants_mutex;
+        std::unordered_map<std::string, Engine> tenant_engines;
+
+        std::mutex helper_mutex;
+        std::condition_variable helper_wake;
+        std::deque<std::packaged_task<void()>> helper_tasks;
+        bool helpers_stopping = false;
+        std::vector<std::thread> helpers; // Declared last so helpers start after the state above
+    };
+};
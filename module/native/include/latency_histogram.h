@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// --- Latency Histogram ---
+
+// Call counts and sampled per-call latency for a hot path, cheap enough to
+// leave on in production. Counters are spread over cache-line stripes picked
+// per thread, so concurrent callers rarely share a line, and only one call
+// in `sample_every` reads the clock. Bucket i counts latencies in
+// [2^i, 2^(i+1)) ns; bucket 0 also counts 0 ns and the last bucket
+// everything above it.
+class LatencyHistogram {
+public:
+    static constexpr size_t bucket_count = 36; // Last bucket starts at ~34 s
+    static constexpr size_t stripe_count = 8;
+
+    struct Snapshot {
+        uint64_t calls = 0;    // Every call, timed or not
+        uint64_t samples = 0;  // Timed calls
+        uint64_t total_ns = 0; // Sum over timed calls
+        std::array<uint64_t, bucket_count> buckets{};
+
+        double mean_ns() const {
+            return samples ? static_cast<double>(total_ns) / samples : 0.0;
+        }
+
+        // Upper bound of the bucket holding quantile q (0..1) of the samples.
+        uint64_t percentile_ns(double q) const {
+            if (samples == 0) {
+                return 0;
+            }
+            uint64_t rank = std::min<uint64_t>(static_cast<uint64_t>(q * samples), samples - 1);
+            uint64_t seen = 0;
+            for (size_t i = 0; i < bucket_count; ++i) {
+                seen += buckets[i];
+                if (seen > rank) {
+                    return upper_bound_ns(i);
+                }
+            }
+            return upper_bound_ns(bucket_count - 1);
+        }
+    };
+
+    // Times one call from construction to destruction if it is sampled.
+    class Scope {
+    public:
+        explicit Scope(LatencyHistogram& h) : histogram(h), sampled(h.begin()) {
+            if (sampled) {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~Scope() {
+            if (sampled) {
+                histogram.record(std::chrono::steady_clock::now() - start);
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        LatencyHistogram& histogram;
+        bool sampled;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // sample_every is rounded up to a power of two.
+    explicit LatencyHistogram(uint32_t sample_every = 1) {
+        uint64_t every = 1;
+        while (every < sample_every) every <<= 1;
+        sample_mask = every - 1;
+    }
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    // Counts a call and returns whether the caller should time it and
+    // record() the result. Scope does both.
+    bool begin() {
+        uint64_t call = local_stripe().calls.fetch_add(1, std::memory_order_relaxed);
+        return (call & sample_mask) == 0;
+    }
+
+    void record(std::chrono::nanoseconds elapsed) {
+        uint64_t ns = elapsed.count() > 0 ? static_cast<uint64_t>(elapsed.count()) : 0;
+        Stripe& stripe = local_stripe();
+        stripe.samples.fetch_add(1, std::memory_order_relaxed);
+        stripe.total_ns.fetch_add(ns, std::memory_order_relaxed);
+        stripe.buckets[bucket_for(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Sums the stripes. Not atomic across counters, so a snapshot taken
+    // under load may be off by the calls in flight.
+    Snapshot snapshot() const {
+        Snapshot result;
+        for (const Stripe& stripe : stripes) {
+            result.calls += stripe.calls.load(std::memory_order_relaxed);
+            result.samples += stripe.samples.load(std::memory_order_relaxed);
+            result.total_ns += stripe.total_ns.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < bucket_count; ++i) {
+                result.buckets[i] += stripe.buckets[i].load(std::memory_order_relaxed);
+            }
+        }
+        return result;
+    }
+
+    static uint64_t upper_bound_ns(size_t bucket) {
+        return uint64_t(1) << (bucket + 1);
+    }
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> samples{0};
+        std::atomic<uint64_t> total_ns{0};
+        std::atomic<uint64_t> buckets[bucket_count]{};
+    };
+
+    static size_t bucket_for(uint64_t ns) {
+        if (ns < 2) {
+            return 0;
+        }
+        return std::min<size_t>(63 - __builtin_clzll(ns), bucket_count - 1);
+    }
+
+    // Threads take stripes round-robin on first use.
+    Stripe& local_stripe() {
+        static std::atomic<size_t> next_stripe{0};
+        thread_local size_t index = next_stripe.fetch_add(1, std::memory_order_relaxed) % stripe_count;
+        return stripes[index];
+    }
+
+    uint64_t sample_mask;
+    std::array<Stripe, stripe_count> stripes;
+};
+
+// Appends `snapshot` in the Prometheus text format: a `name` histogram in
+// seconds over the timed calls, and a `name`_calls_total counter.
+inline void append_prometheus(std::string& out, const std::string& name,
+                              const LatencyHistogram::Snapshot& snapshot) {
+    char line[256];
+    out += "# TYPE " + name + " histogram\n";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i + 1 < LatencyHistogram::bucket_count; ++i) {
+        cumulative += snapshot.buckets[i];
+        std::snprintf(line, sizeof(line), "%s_bucket{le=\"%.9g\"} %llu\n", name.c_str(),
+                      LatencyHistogram::upper_bound_ns(i) * 1e-9, static_cast<unsigned long long>(cumulative));
+        out += line;
+    }
+    std::snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9g\n%s_count %llu\n",
+                  name.c_str(), static_cast<unsigned long long>(snapshot.samples), name.c_str(),
+                  snapshot.total_ns * 1e-9, name.c_str(), static_cast<unsigned long long>(snapshot.samples));
+    out += line;
+    std::snprintf(line, sizeof(line), "# TYPE %s_calls_total counter\n%s_calls_total %llu\n", name.c_str(),
+                  name.c_str(), static_cast<unsigned long long>(snapshot.calls));
+    out += line;
+}
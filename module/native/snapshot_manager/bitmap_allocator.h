@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// --- Bitmap Allocator ---
+
+// Hierarchical chunk bitmap. Leaf words hold one bit per chunk
+// (1 = allocated). Above them sit summary levels: a bit in the first level
+// says its leaf word still has a free chunk, a bit in each higher level
+// says the word below is non-zero, up to a single top word. Finding the
+// lowest free chunk is one ctz per level (four levels cover 2^24 chunks),
+// so the cost stays flat from an empty device to a nearly full one instead
+// of growing with the number of full words skipped. Contiguous runs are
+// found by walking non-full words through the summary and measuring
+// stretches of empty leaf words with SIMD compares.
+//
+// Not thread-safe; ChunkAllocator serializes access and keeps per-CPU
+// caches in front of it.
+class BitmapAllocator {
+public:
+    static constexpr uint64_t npos = UINT64_MAX;
+
+    explicit BitmapAllocator(uint64_t total_chunks = 0)
+        : total(total_chunks), free_chunks(total_chunks), leaves((total_chunks + 63) / 64, 0) {
+        size_t bits = leaves.size();
+        do {
+            size_t words = (bits + 63) / 64;
+            std::vector<uint64_t> level(words, 0);
+            for (size_t b = 0; b < bits; ++b) {
+                level[b / 64] |= uint64_t(1) << (b % 64);
+            }
+            summary.push_back(std::move(level));
+            bits = words;
+        } while (bits > 1);
+
+        // Bits past the end of the device are permanently allocated.
+        if (total % 64) {
+            leaves.back() = ~((uint64_t(1) << (total % 64)) - 1);
+        }
+    }
+
+    uint64_t capacity() const { return total; }
+    uint64_t free_count() const { return free_chunks; }
+
+    bool is_allocated(uint64_t chunk) const {
+        return leaves[chunk / 64] & (uint64_t(1) << (chunk % 64));
+    }
+
+    // Allocates the lowest free chunk, or returns npos when full.
+    uint64_t find_and_set_first_zero() {
+        uint64_t chunk = npos;
+        allocate(1, &chunk);
+        return chunk;
+    }
+
+    // Allocates up to `count` chunks into `out`, taking free bits a whole
+    // leaf word at a time. Returns how many were allocated.
+    size_t allocate(size_t count, uint64_t* out) {
+        size_t done = 0;
+        while (done < count) {
+            size_t word = next_nonfull_word(0);
+            if (word == SIZE_MAX) {
+                break;
+            }
+            uint64_t free_bits = ~leaves[word];
+            uint64_t taken = 0;
+            while (free_bits && done < count) {
+                unsigned bit = __builtin_ctzll(free_bits);
+                out[done++] = word * 64 + bit;
+                taken |= uint64_t(1) << bit;
+                free_bits &= free_bits - 1;
+            }
+            set_leaf_bits(word, taken);
+        }
+        return done;
+    }
+
+    // Allocates `count` consecutive chunks and returns the first, or npos
+    // if no free run is long enough.
+    uint64_t allocate_contiguous(size_t count) {
+        if (count == 0 || count > free_chunks) {
+            return npos;
+        }
+        uint64_t start = find_run(count);
+        if (start != npos) {
+            update_range(start, count, true);
+        }
+        return start;
+    }
+
+    void release(uint64_t chunk) {
+        release_bits(chunk / 64, uint64_t(1) << (chunk % 64));
+    }
+
+    void release(const uint64_t* chunks, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            release(chunks[i]);
+        }
+    }
+
+    void release_contiguous(uint64_t start, size_t count) {
+        update_range(start, count, false);
+    }
+
+private:
+    // Mask of the bits at positions >= `bit` in a word.
+    static uint64_t mask_from(unsigned bit) {
+        return bit >= 64 ? 0 : ~uint64_t(0) << bit;
+    }
+
+    // Next set bit at index >= pos in summary level `level`, or SIZE_MAX.
+    size_t next_set(size_t level, size_t pos) const {
+        const std::vector<uint64_t>& bits = summary[level];
+        size_t word = pos / 64;
+        if (word >= bits.size()) {
+            return SIZE_MAX;
+        }
+        uint64_t masked = bits[word] & mask_from(pos % 64);
+        if (!masked) {
+            if (level + 1 == summary.size()) {
+                return SIZE_MAX;
+            }
+            word = next_set(level + 1, word + 1);
+            if (word == SIZE_MAX) {
+                return SIZE_MAX;
+            }
+            masked = bits[word];
+        }
+        return word * 64 + __builtin_ctzll(masked);
+    }
+
+    size_t next_nonfull_word(size_t from) const {
+        return next_set(0, from);
+    }
+
+    // Clears `index` in `level` and propagates upwards while words empty.
+    void summary_clear(size_t level, size_t index) {
+        for (; level < summary.size(); ++level) {
+            uint64_t& word = summary[level][index / 64];
+            word &= ~(uint64_t(1) << (index % 64));
+            if (word) {
+                return;
+            }
+            index /= 64;
+        }
+    }
+
+    // Sets `index` in `level` and propagates upwards until already set.
+    void summary_set(size_t level, size_t index) {
+        for (; level < summary.size(); ++level) {
+            uint64_t& word = summary[level][index / 64];
+            bool was_empty = word == 0;
+            word |= uint64_t(1) << (index % 64);
+            if (!was_empty) {
+                return;
+            }
+            index /= 64;
+        }
+    }
+
+    void set_leaf_bits(size_t word, uint64_t bits) {
+        free_chunks -= __builtin_popcountll(bits & ~leaves[word]);
+        leaves[word] |= bits;
+        if (leaves[word] == UINT64_MAX) {
+            summary_clear(0, word);
+        }
+    }
+
+    void release_bits(size_t word, uint64_t bits) {
+        bool was_full = leaves[word] == UINT64_MAX;
+        free_chunks += __builtin_popcountll(bits & leaves[word]);
+        leaves[word] &= ~bits;
+        if (was_full) {
+            summary_set(0, word);
+        }
+    }
+
+    void update_range(uint64_t start, size_t count, bool allocate_bits) {
+        uint64_t end = start + count;
+        while (start < end) {
+            size_t word = start / 64;
+            unsigned lo = start % 64;
+            unsigned hi = end - word * 64 >= 64 ? 64 : static_cast<unsigned>(end - word * 64);
+            uint64_t bits = mask_from(lo) & ~mask_from(hi);
+            if (allocate_bits) {
+                set_leaf_bits(word, bits);
+            } else {
+                release_bits(word, bits);
+            }
+            start = word * 64 + hi;
+        }
+    }
+
+    // Number of consecutive all-free leaf words starting at `word`, counting
+    // no further than `max_words`.
+    size_t empty_words_from(size_t word, size_t max_words) const {
+        const uint64_t* p = leaves.data() + word;
+        size_t limit = std::min(leaves.size() - word, max_words);
+        size_t n = 0;
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        for (; n + 4 <= limit; n += 4) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + n));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + n + 2));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_or_si128(a, b), zero)) != 0xffff) {
+                break;
+            }
+        }
+#elif defined(__ARM_NEON)
+        for (; n + 4 <= limit; n += 4) {
+            uint64x2_t a = vld1q_u64(p + n);
+            uint64x2_t b = vld1q_u64(p + n + 2);
+            uint64x2_t any = vorrq_u64(a, b);
+            if (vgetq_lane_u64(any, 0) | vgetq_lane_u64(any, 1)) {
+                break;
+            }
+        }
+#endif
+        while (n < limit && p[n] == 0) {
+            ++n;
+        }
+        return n;
+    }
+
+    // Lowest start of `count` consecutive free chunks, or npos.
+    uint64_t find_run(size_t count) const {
+        uint64_t run_start = 0;
+        uint64_t run_length = 0;
+        size_t word = next_nonfull_word(0);
+
+        while (word != SIZE_MAX) {
+            if (run_length && run_start + run_length != word * 64) {
+                run_length = 0; // A full word broke the run
+            }
+
+            uint64_t bits = leaves[word];
+            if (bits == 0) {
+                if (!run_length) {
+                    run_start = word * 64;
+                }
+                size_t empty = empty_words_from(word, (count - run_length + 63) / 64);
+                run_length += empty * 64;
+                if (run_length >= count) {
+                    return run_start;
+                }
+                word = next_nonfull_word(word + empty);
+                continue;
+            }
+
+            // Free bits at the bottom extend a run from the previous word.
+            unsigned low_free = __builtin_ctzll(bits);
+            if (run_length && run_length + low_free >= count) {
+                return run_start;
+            }
+
+            if (count <= 64) {
+                // Bit i of `starts` is set when bits i..i+count-1 are all free.
+                uint64_t starts = ~bits;
+                size_t have = 1;
+                while (have < count && starts) {
+                    size_t shift = std::min(have, count - have);
+                    starts &= starts >> shift;
+                    have += shift;
+                }
+                if (starts) {
+                    return word * 64 + __builtin_ctzll(starts);
+                }
+            }
+
+            // Free bits at the top may start a run into the next word.
+            unsigned high_free = __builtin_clzll(bits);
+            run_start = word * 64 + 64 - high_free;
+            run_length = high_free;
+            word = next_nonfull_word(word + 1);
+        }
+        return npos;
+    }
+
+    uint64_t total;
+    uint64_t free_chunks;
+    std::vector<uint64_t> leaves;
+    std::vector<std::vector<uint64_t>> summary; // summary[0] covers the leaf words
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <sched.h>
+
+#include "bitmap_allocator.h"
+
+// --- Chunk Allocator ---
+
+// COW chunk allocation with per-CPU caches in front of the shared
+// bitmap. A fault allocates from its CPU's cache, which is refilled (and
+// drained on overflow) in batches, so the global allocation_mutex is
+// taken once per cache_batch chunks instead of once per chunk. Cached
+// chunks count as allocated in the bitmap until they are handed out or
+// returned by drain_caches().
+class ChunkAllocator {
+    static constexpr size_t cache_batch = 64;
+    static constexpr size_t cache_capacity = 2 * cache_batch;
+
+    struct alignas(64) CpuCache {
+        std::mutex lock; // Only contended when a thread migrates mid-call
+        size_t count = 0;
+        uint64_t chunks[cache_capacity];
+    };
+
+    std::unique_ptr<BitmapAllocator> allocator;
+    std::mutex allocation_mutex;
+    std::unique_ptr<CpuCache[]> caches;
+    size_t cache_count;
+
+    CpuCache& local_cache() {
+        int cpu = sched_getcpu();
+        return caches[(cpu < 0 ? 0 : static_cast<size_t>(cpu)) % cache_count];
+    }
+
+public:
+    static constexpr uint64_t npos = BitmapAllocator::npos;
+
+    explicit ChunkAllocator(uint64_t total_chunks, size_t cpus = 0)
+        : allocator(std::make_unique<BitmapAllocator>(total_chunks)) {
+        if (!cpus) {
+            cpus = std::max(1u, std::thread::hardware_concurrency());
+        }
+        cache_count = cpus;
+        caches = std::make_unique<CpuCache[]>(cache_count);
+    }
+
+    // Returns npos when the COW device is full.
+    uint64_t allocate_chunk() {
+        uint64_t chunk = npos;
+        allocate_chunks(1, &chunk);
+        return chunk;
+    }
+
+    // Allocates up to `count` chunks into `out` and returns how many
+    // were allocated; fewer than requested means the device is full.
+    size_t allocate_chunks(size_t count, uint64_t* out) {
+        CpuCache& cache = local_cache();
+        std::lock_guard<std::mutex> cache_lock(cache.lock);
+
+        size_t done = 0;
+        while (done < count) {
+            if (cache.count == 0) {
+                std::lock_guard<std::mutex> lock(allocation_mutex);
+                // Large requests bypass the cache; small ones refill it.
+                size_t want = count - done;
+                if (want >= cache_batch) {
+                    done += allocator->allocate(want, out + done);
+                    break;
+                }
+                cache.count = allocator->allocate(cache_batch, cache.chunks);
+                if (cache.count == 0) {
+                    break;
+                }
+            }
+            size_t take = std::min(count - done, cache.count);
+            // LIFO, so recently freed (cache-hot) chunks are reused first.
+            std::copy(cache.chunks + cache.count - take, cache.chunks + cache.count, out + done);
+            cache.count -= take;
+            done += take;
+        }
+        return done;
+    }
+
+    void free_chunk(uint64_t chunk) {
+        free_chunks(&chunk, 1);
+    }
+
+    void free_chunks(const uint64_t* chunks, size_t count) {
+        CpuCache& cache = local_cache();
+        std::lock_guard<std::mutex> cache_lock(cache.lock);
+
+        size_t room = cache_capacity - cache.count;
+        size_t keep = std::min(room, count);
+        std::copy(chunks, chunks + keep, cache.chunks + cache.count);
+        cache.count += keep;
+        if (keep == count && cache.count < cache_capacity) {
+            return;
+        }
+
+        // Overflow: return the remainder plus half the cache in one batch.
+        std::lock_guard<std::mutex> lock(allocation_mutex);
+        allocator->release(chunks + keep, count - keep);
+        size_t spill = cache.count / 2;
+        allocator->release(cache.chunks + cache.count - spill, spill);
+        cache.count -= spill;
+    }
+
+    // Large sequential writes take a contiguous run straight from the
+    // bitmap so their exceptions stay adjacent on the COW device.
+    uint64_t allocate_run(size_t count) {
+        std::lock_guard<std::mutex> lock(allocation_mutex);
+        return allocator->allocate_contiguous(count);
+    }
+
+    void free_run(uint64_t start, size_t count) {
+        std::lock_guard<std::mutex> lock(allocation_mutex);
+        allocator->release_contiguous(start, count);
+    }
+
+    // Free chunks in the bitmap; chunks parked in CPU caches count as used.
+    uint64_t free_space() {
+        std::lock_guard<std::mutex> lock(allocation_mutex);
+        return allocator->free_count();
+    }
+
+    // Returns every cached chunk to the bitmap.
+    void drain_caches() {
+        for (size_t i = 0; i < cache_count; ++i) {
+            std::lock_guard<std::mutex> cache_lock(caches[i].lock);
+            std::lock_guard<std::mutex> lock(allocation_mutex);
+            allocator->release(caches[i].chunks, caches[i].count);
+            caches[i].count = 0;
+        }
+    }
+};
@@ -4,22 +4,46 @@
 #include <atomic>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
 #include <thread>
 #include <chrono>
 #include <unordered_map>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+
+#include "chunk_allocator.h"
+#include "exception_store.h"
+#include "snapshot_export.h"
+#include "latency_histogram.h"
 
 // --- Placeholder Linux Headers and System Call Stubs ---
 // These would be replaced by actual kernel headers on a Linux build environment.
 
 #define DM_DEV_CREATE 0 // Placeholder for ioctl command
+#define DM_TABLE_LOAD 1
+#define DM_DEV_SUSPEND 2 // Resumes unless DM_SUSPEND_FLAG is set
+#define DM_DEV_REMOVE 3
+#define DM_TABLE_STATUS 4
+#define DM_TABLE_CLEAR 5
+#define DM_SUSPEND_FLAG (1 << 1)
 struct dm_ioctl {
     int target_count;
+    uint32_t data_size;  // Total size of the ioctl buffer, header included
+    uint32_t data_start; // Offset of the first dm_target_spec
+    uint32_t flags;
+    char name[128];
     // other fields...
 };
 struct dm_target_spec {
     long long sector_start;
     long long length;
     int status;
+    uint32_t next; // Offset from this spec to the next one
     char target_type[256];
 };
 
@@ -30,94 +54,842 @@ int ioctl(int fd, unsigned long request, ...) {
 }
 long long get_device_size(const std::string& device) { return 1024 * 1024 * 1024; /* 1GB */ }
 std::string create_cow_device(const std::string& name) { return "/dev/cow_" + name; }
-dm_ioctl* prepare_dm_ioctl(const std::string& name) { return new dm_ioctl(); }
-dm_target_spec* get_dm_target(dm_ioctl* io) { return new dm_target_spec(); }
-char* get_target_params(dm_target_spec* tgt) { return new char[1024]; }
 uint64_t calculate_cow_usage(const auto& snapshot) { return 0; }
-void merge_old_chunks(const auto& snapshot) {}
 
 // --- Class Implementations ---
 
-class BitmapAllocator {
-public:
-    uint64_t find_and_set_first_zero() { return 0; }
+struct SnapshotRequest {
+    std::string origin_device;
+    std::string snapshot_name;
+};
+
+// Which of the two diffed snapshots hold an exception for a chunk range.
+enum class DiffKind {
+    FirstOnly,
+    SecondOnly,
+    Both,
+};
+
+struct DiffExtent {
+    uint64_t origin_chunk;
+    uint64_t length;
+    DiffKind kind;
+};
+
+struct MergeProgress {
+    std::string snapshot;
+    uint64_t merged_chunks;
+    uint64_t total_chunks;
 };
 
 class COWSnapshotManager {
 private:
-    struct ChunkMapping {};
     struct SnapshotMetadata {
         uint64_t origin_size;
         uint64_t chunk_size;
-        std::vector<ChunkMapping> mappings;
-        std::atomic<uint64_t> write_counter;
+        mutable std::shared_mutex mappings_mutex;
+        ExceptionStore mappings;
+        std::atomic<uint64_t> write_counter{0};   // Chunks copied out since the last merge
+        std::atomic<uint64_t> usage_threshold{0}; // Chunks written before the monitor merges
+        std::atomic<bool> merge_queued{false};
     };
+
+    // Merges `count` COW chunks starting at `first_chunk` back into the
+    // origin and returns how many were merged. Placeholder for the merge
+    // target, like the system stubs above.
+    static uint64_t merge_chunk_batch(const SnapshotMetadata&, uint64_t, uint64_t count) { return count; }
     
-    class ChunkAllocator {
-        std::unique_ptr<BitmapAllocator> allocator;
-        std::mutex allocation_mutex;
-        
+    // Background chunk merging. Each snapshot's merge is a job that workers
+    // advance one bounded batch at a time, round-robin, so several
+    // snapshots merge in parallel and none monopolizes the pool. Every batch
+    // first draws from a shared bandwidth/IOPS budget (a token bucket that
+    // may run into debt for one batch), which keeps merge traffic below the
+    // configured rate and leaves the rest of the device to foreground I/O.
+    class MergeScheduler {
+    public:
+        // Merges up to `count` chunks of `snapshot` from `first_chunk` and
+        // returns how many were merged; 0 abandons the job.
+        using BatchFn = std::function<uint64_t(const std::string& snapshot, uint64_t first_chunk, uint64_t count)>;
+
+        explicit MergeScheduler(BatchFn batch_fn, size_t workers = 2, uint64_t batch_chunks = 256)
+            : merge_batch(std::move(batch_fn)), batch_chunks(std::max<uint64_t>(1, batch_chunks)) {
+            last_refill = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < std::max<size_t>(1, workers); ++i) {
+                pool.emplace_back(&MergeScheduler::worker_loop, this);
+            }
+        }
+
+        ~MergeScheduler() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto& worker : pool) {
+                worker.join();
+            }
+        }
+
+        MergeScheduler(const MergeScheduler&) = delete;
+        MergeScheduler& operator=(const MergeScheduler&) = delete;
+
+        // Adds `chunks` to the snapshot's merge, starting a job if none is
+        // running.
+        void schedule(const std::string& snapshot, uint64_t chunks, uint64_t chunk_bytes) {
+            if (chunks == 0) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto [it, inserted] = jobs.try_emplace(snapshot);
+                if (inserted) {
+                    it->second = std::make_shared<Job>();
+                    it->second->snapshot = snapshot;
+                    ready.push_back(it->second);
+                }
+                it->second->total_chunks += chunks;
+                it->second->chunk_bytes = chunk_bytes;
+            }
+            wake.notify_all();
+        }
+
+        // Zero disables the corresponding limit.
+        void set_budget(uint64_t bytes_per_second, uint64_t iops) {
+            std::lock_guard<std::mutex> lock(mutex);
+            byte_rate = bytes_per_second;
+            io_rate = iops;
+            byte_tokens = static_cast<double>(byte_rate);
+            io_tokens = static_cast<double>(io_rate);
+            last_refill = std::chrono::steady_clock::now();
+        }
+
+        std::vector<MergeProgress> progress() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<MergeProgress> result;
+            result.reserve(jobs.size());
+            for (const auto& [name, job] : jobs) {
+                result.push_back({name, job->merged_chunks, job->total_chunks});
+            }
+            return result;
+        }
+
+        uint64_t completed_merges() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return completed;
+        }
+
+    private:
+        struct Job {
+            std::string snapshot;
+            uint64_t total_chunks = 0;
+            uint64_t merged_chunks = 0;
+            uint64_t chunk_bytes = 0;
+        };
+
+        // Blocks until the budget covers one batch. Returns false on shutdown.
+        bool acquire_budget(std::unique_lock<std::mutex>& lock, uint64_t bytes, uint64_t ios) {
+            while (!stopping) {
+                auto now = std::chrono::steady_clock::now();
+                double elapsed = std::chrono::duration<double>(now - last_refill).count();
+                last_refill = now;
+                // Burst is capped at one second of budget.
+                byte_tokens = std::min<double>(byte_rate, byte_tokens + elapsed * byte_rate);
+                io_tokens = std::min<double>(io_rate, io_tokens + elapsed * io_rate);
+
+                bool bytes_ok = byte_rate == 0 || byte_tokens > 0;
+                bool ios_ok = io_rate == 0 || io_tokens > 0;
+                if (bytes_ok && ios_ok) {
+                    if (byte_rate) byte_tokens -= static_cast<double>(bytes);
+                    if (io_rate) io_tokens -= static_cast<double>(ios);
+                    return true;
+                }
+
+                double wait = 0;
+                if (!bytes_ok) wait = std::max(wait, (1.0 - byte_tokens) / byte_rate);
+                if (!ios_ok) wait = std::max(wait, (1.0 - io_tokens) / io_rate);
+                wake.wait_for(lock, std::chrono::duration<double>(wait));
+            }
+            return false;
+        }
+
+        void worker_loop() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                wake.wait(lock, [this] { return stopping || !ready.empty(); });
+                if (stopping) {
+                    return;
+                }
+                std::shared_ptr<Job> job = std::move(ready.front());
+                ready.pop_front();
+
+                uint64_t count = std::min(batch_chunks, job->total_chunks - job->merged_chunks);
+                if (!acquire_budget(lock, count * job->chunk_bytes, count)) {
+                    return;
+                }
+                uint64_t first = job->merged_chunks;
+                lock.unlock();
+                uint64_t merged = merge_batch(job->snapshot, first, count);
+                lock.lock();
+
+                job->merged_chunks += merged;
+                if (merged == 0 || job->merged_chunks >= job->total_chunks) {
+                    jobs.erase(job->snapshot);
+                    ++completed;
+                } else {
+                    ready.push_back(std::move(job));
+                }
+            }
+        }
+
+        const BatchFn merge_batch;
+        const uint64_t batch_chunks;
+
+        mutable std::mutex mutex;
+        std::condition_variable wake;
+        std::unordered_map<std::string, std::shared_ptr<Job>> jobs;
+        std::deque<std::shared_ptr<Job>> ready; // Jobs not held by a worker
+        uint64_t completed = 0;
+        bool stopping = false;
+
+        uint64_t byte_rate = 0;
+        uint64_t io_rate = 0;
+        double byte_tokens = 0;
+        double io_tokens = 0;
+        std::chrono::steady_clock::time_point last_refill;
+
+        std::vector<std::thread> pool; // Declared last so workers start after the state above
+    };
+
+    // Snapshot registry with RCU-style reads. The map is immutable once
+    // published: writers copy it under write_mutex, modify the copy and
+    // publish it with an atomic shared_ptr store, while readers take a
+    // reference to whichever map is current without touching write_mutex.
+    // Creation therefore never blocks monitoring or lookups and vice versa,
+    // and metadata handed out stays alive until its last reader lets go.
+    class SnapshotRegistry {
     public:
-        ChunkAllocator() : allocator(std::make_unique<BitmapAllocator>()) {}
-        uint64_t allocate_chunk() {
-            std::lock_guard<std::mutex> lock(allocation_mutex);
-            return allocator->find_and_set_first_zero();
+        using Map = std::unordered_map<std::string, std::shared_ptr<SnapshotMetadata>>;
+
+        SnapshotRegistry() : current(std::make_shared<const Map>()) {}
+
+        std::shared_ptr<const Map> snapshot() const {
+            return std::atomic_load_explicit(&current, std::memory_order_acquire);
+        }
+
+        std::shared_ptr<SnapshotMetadata> find(const std::string& name) const {
+            std::shared_ptr<const Map> map = snapshot();
+            auto it = map->find(name);
+            return it == map->end() ? nullptr : it->second;
+        }
+
+        // Runs `fn` on a private copy of the map and publishes the result.
+        template<typename Fn>
+        void update(Fn&& fn) {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            auto next = std::make_shared<Map>(*current);
+            fn(*next);
+            std::atomic_store_explicit(&current, std::shared_ptr<const Map>(std::move(next)),
+                                       std::memory_order_release);
+        }
+
+    private:
+        std::mutex write_mutex;
+        std::shared_ptr<const Map> current;
+    };
+
+    // Reusable buffer for dm ioctls, laid out as the kernel expects: the
+    // dm_ioctl header, then each dm_target_spec followed by its parameter
+    // string. It only grows, so once it has seen the largest request every
+    // create/remove/status ioctl is built without touching the heap.
+    class IoctlArena {
+    public:
+        explicit IoctlArena(size_t initial_bytes = 16384) : storage((initial_bytes + 7) / 8) {}
+
+        // Zeroed, 8-byte aligned space for `bytes`, valid until the next call.
+        char* acquire(size_t bytes) {
+            size_t words = (bytes + 7) / 8;
+            if (storage.size() < words) {
+                storage.resize(words);
+            }
+            char* buffer = reinterpret_cast<char*>(storage.data());
+            std::memset(buffer, 0, bytes);
+            return buffer;
         }
+
+        size_t capacity() const { return storage.size() * sizeof(uint64_t); }
+
+    private:
+        std::vector<uint64_t> storage;
     };
 
     int dm_fd = 0; // Mock device-mapper file descriptor
-    bool monitoring = false;
-    uint64_t threshold = 1000;
-    std::unordered_map<std::string, SnapshotMetadata> active_snapshots;
+    std::mutex ioctl_mutex; // Guards ioctl_arena
+    IoctlArena ioctl_arena;
+    std::atomic<bool> monitoring{false};
+    uint64_t threshold = 1000; // Default per-snapshot threshold, in chunks
+    std::chrono::milliseconds sweep_interval{30000};
+
+    SnapshotRegistry active_snapshots;
+
+    // Hot-path metrics, see metrics(). Exception inserts and lookups run
+    // once per COW fault and snapshot read, so they are sampled.
+    LatencyHistogram create_latency;
+    LatencyHistogram exception_insert_latency{16};
+    mutable LatencyHistogram exception_lookup_latency{64};
+
+    // Snapshots whose write_counter crossed their threshold, waiting for the
+    // monitor thread.
+    std::mutex monitor_mutex;
+    std::condition_variable monitor_wake;
+    std::vector<std::string> pending_merges;
     std::thread monitor_thread;
 
+    // Declared after the registry it merges from so its workers stop first.
+    MergeScheduler merges{[this](const std::string& name, uint64_t first_chunk, uint64_t count) {
+        std::shared_ptr<SnapshotMetadata> snapshot = active_snapshots.find(name);
+        return snapshot ? merge_chunk_batch(*snapshot, first_chunk, count) : 0;
+    }};
+
+    void queue_merge(const std::string& name, SnapshotMetadata& snapshot) {
+        if (snapshot.merge_queued.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(monitor_mutex);
+            pending_merges.push_back(name);
+        }
+        monitor_wake.notify_one();
+    }
+
 public:
     ~COWSnapshotManager() {
-        monitoring = false;
-        if (monitor_thread.joinable()) {
-            monitor_thread.join();
-        }
+        stop_monitoring();
     }
 
     int create_snapshot(const std::string& origin_device, 
                        const std::string& snapshot_name) {
-        dm_ioctl* io = prepare_dm_ioctl(snapshot_name);
-        io->target_count = 1;
-        
-        dm_target_spec* tgt = get_dm_target(io);
-        tgt->status = 0;
-        tgt->sector_start = 0;
-        tgt->length = get_device_size(origin_device);
-        strcpy(tgt->target_type, "snapshot");
-        
+        LatencyHistogram::Scope timing(create_latency);
+        long long origin_size = get_device_size(origin_device);
         std::string cow_device = create_cow_device(snapshot_name);
-        sprintf(get_target_params(tgt), "%s %s P 8", 
-                origin_device.c_str(), cow_device.c_str());
-        
-        int result = ioctl(dm_fd, DM_DEV_CREATE, io);
-        
-        // Cleanup mock objects
-        delete[] get_target_params(tgt);
-        delete tgt;
-        delete io;
-        
+        int result;
+        {
+            std::lock_guard<std::mutex> lock(ioctl_mutex);
+            const char* format = "%s %s P 8";
+            size_t params_len = std::snprintf(nullptr, 0, format, origin_device.c_str(), cow_device.c_str());
+            char* buffer = ioctl_arena.acquire(table_ioctl_bytes(params_len));
+
+            init_ioctl(buffer, sizeof(dm_ioctl), snapshot_name, 0);
+            result = ioctl(dm_fd, DM_DEV_CREATE, buffer);
+            if (result != 0) {
+                return result;
+            }
+            char* params = init_table_ioctl(buffer, snapshot_name, "snapshot", origin_size / 512, params_len);
+            std::snprintf(params, params_len + 1, format, origin_device.c_str(), cow_device.c_str());
+            result = ioctl(dm_fd, DM_TABLE_LOAD, buffer);
+            if (result == 0) {
+                // Resuming the new device activates the loaded table.
+                init_ioctl(buffer, sizeof(dm_ioctl), snapshot_name, 0);
+                result = ioctl(dm_fd, DM_DEV_SUSPEND, buffer);
+            }
+            if (result != 0) {
+                // Don't leave a table-less device behind to block a retry.
+                device_ioctl(DM_DEV_REMOVE, snapshot_name);
+            }
+        }
+
+        if (result == 0) {
+            register_snapshot(snapshot_name, origin_size);
+        }
         return result;
     }
-    
-    void start_monitoring() {
-        monitoring = true;
+
+    int remove_snapshot(const std::string& snapshot_name) {
+        int result;
+        {
+            std::lock_guard<std::mutex> lock(ioctl_mutex);
+            char* buffer = ioctl_arena.acquire(sizeof(dm_ioctl));
+            init_ioctl(buffer, sizeof(dm_ioctl), snapshot_name, 0);
+            result = ioctl(dm_fd, DM_DEV_REMOVE, buffer);
+        }
+        if (result == 0) {
+            active_snapshots.update([&](SnapshotRegistry::Map& map) {
+                map.erase(snapshot_name);
+            });
+        }
+        return result;
+    }
+
+    // Copies the snapshot target's status line (e.g. "used/total" COW
+    // sectors) into `status`. The kernel writes it into the arena.
+    int snapshot_status(const std::string& snapshot_name, char* status, size_t status_size) {
+        std::lock_guard<std::mutex> lock(ioctl_mutex);
+        size_t capacity = ioctl_arena.capacity();
+        char* buffer = ioctl_arena.acquire(capacity);
+        dm_ioctl* io = init_ioctl(buffer, capacity, snapshot_name, 0);
+        int result = ioctl(dm_fd, DM_TABLE_STATUS, buffer);
+        if (result == 0 && status_size) {
+            const char* params = "";
+            if (io->target_count > 0) {
+                params = reinterpret_cast<const char*>(buffer + io->data_start + sizeof(dm_target_spec));
+            }
+            std::snprintf(status, status_size, "%s", params);
+        }
+        return result;
+    }
+
+    // Snapshots several origins at one consistent point in time. Every
+    // ioctl is laid out up front in a single buffer, and the snapshot
+    // devices and all inactive tables are created and loaded before any
+    // origin is frozen. That leaves only the unavoidable per-device
+    // suspend/resume ioctls inside the freeze window: suspend every origin,
+    // resume every snapshot, then resume every origin.
+    // Returns 0 or the first failing ioctl result. Origins are always
+    // resumed before returning. A failure before the origins are resumed
+    // rolls the group back: the staged snapshot-origin tables are cleared
+    // and the snapshot devices removed, so every origin runs on its old
+    // table. A failure while resuming origins happens once the snapshots
+    // are live, so they are kept and registered and only the error is
+    // returned.
+    int create_snapshot_group(const std::vector<SnapshotRequest>& members) {
+        struct Member {
+            long long origin_size;
+            size_t create, snapshot_table, origin_table, suspend_origin, resume_snapshot, resume_origin;
+        };
+
+        std::vector<Member> plan(members.size());
+        std::vector<std::string> snapshot_params(members.size());
+        std::vector<std::string> origin_params(members.size());
+        size_t total = 0;
+        auto reserve = [&total](size_t bytes) {
+            size_t offset = total;
+            total += align_ioctl(bytes);
+            return offset;
+        };
+        for (size_t i = 0; i < members.size(); ++i) {
+            const SnapshotRequest& member = members[i];
+            snapshot_params[i] = member.origin_device + " " + create_cow_device(member.snapshot_name) + " P 8";
+            origin_params[i] = member.origin_device;
+
+            Member& m = plan[i];
+            m.origin_size = get_device_size(member.origin_device);
+            m.create = reserve(sizeof(dm_ioctl));
+            m.snapshot_table = reserve(table_ioctl_bytes(snapshot_params[i].size()));
+            m.origin_table = reserve(table_ioctl_bytes(origin_params[i].size()));
+            m.suspend_origin = reserve(sizeof(dm_ioctl));
+            m.resume_snapshot = reserve(sizeof(dm_ioctl));
+            m.resume_origin = reserve(sizeof(dm_ioctl));
+        }
+
+        // The whole group shares one arena buffer for the duration of the call.
+        std::lock_guard<std::mutex> lock(ioctl_mutex);
+        char* buffer = ioctl_arena.acquire(total);
+        for (size_t i = 0; i < members.size(); ++i) {
+            const SnapshotRequest& member = members[i];
+            const Member& m = plan[i];
+            long long sectors = m.origin_size / 512;
+            init_ioctl(buffer + m.create, sizeof(dm_ioctl), member.snapshot_name, 0);
+            std::memcpy(init_table_ioctl(buffer + m.snapshot_table, member.snapshot_name, "snapshot", sectors,
+                                         snapshot_params[i].size()),
+                        snapshot_params[i].c_str(), snapshot_params[i].size() + 1);
+            std::memcpy(init_table_ioctl(buffer + m.origin_table, member.origin_device, "snapshot-origin", sectors,
+                                         origin_params[i].size()),
+                        origin_params[i].c_str(), origin_params[i].size() + 1);
+            init_ioctl(buffer + m.suspend_origin, sizeof(dm_ioctl), member.origin_device, DM_SUSPEND_FLAG);
+            init_ioctl(buffer + m.resume_snapshot, sizeof(dm_ioctl), member.snapshot_name, 0);
+            init_ioctl(buffer + m.resume_origin, sizeof(dm_ioctl), member.origin_device, 0);
+        }
+
+        // Undoes the preparation of the first `created` members. Clearing
+        // the staged origin tables first means no later resume of an origin,
+        // ours or anyone's, can activate a table pointing at a removed
+        // snapshot.
+        size_t created = 0, staged = 0;
+        auto clear_staged_tables = [&] {
+            for (size_t i = 0; i < staged; ++i) {
+                device_ioctl(DM_TABLE_CLEAR, members[i].origin_device);
+            }
+        };
+        auto remove_created_devices = [&] {
+            for (size_t i = 0; i < created; ++i) {
+                device_ioctl(DM_DEV_REMOVE, members[i].snapshot_name);
+            }
+        };
+
+        // Outside the freeze window: devices and inactive tables.
+        for (const Member& m : plan) {
+            int result = ioctl(dm_fd, DM_DEV_CREATE, buffer + m.create);
+            if (result == 0) {
+                ++created;
+                result = ioctl(dm_fd, DM_TABLE_LOAD, buffer + m.snapshot_table);
+            }
+            if (result == 0) result = ioctl(dm_fd, DM_TABLE_LOAD, buffer + m.origin_table);
+            if (result != 0) {
+                clear_staged_tables();
+                remove_created_devices();
+                return result;
+            }
+            ++staged;
+        }
+
+        // Freeze window.
+        int result = 0;
+        size_t suspended = 0;
+        for (; suspended < plan.size() && result == 0; ++suspended) {
+            result = ioctl(dm_fd, DM_DEV_SUSPEND, buffer + plan[suspended].suspend_origin);
+        }
+        if (result != 0) {
+            --suspended; // The failed suspend did not take effect
+        }
+        for (size_t i = 0; i < plan.size() && result == 0; ++i) {
+            result = ioctl(dm_fd, DM_DEV_SUSPEND, buffer + plan[i].resume_snapshot);
+        }
+        bool rolled_back = result != 0;
+        if (rolled_back) {
+            // The origins resume below onto their old live tables.
+            clear_staged_tables();
+        }
+        for (size_t i = 0; i < suspended; ++i) {
+            int resumed = ioctl(dm_fd, DM_DEV_SUSPEND, buffer + plan[i].resume_origin);
+            if (result == 0) {
+                result = resumed;
+            }
+        }
+        if (rolled_back) {
+            remove_created_devices();
+            return result;
+        }
+
+        // One publish, so readers see either none or all of the group.
+        active_snapshots.update([&](SnapshotRegistry::Map& map) {
+            for (size_t i = 0; i < members.size(); ++i) {
+                map[members[i].snapshot_name] = new_metadata(plan[i].origin_size);
+            }
+        });
+        return result;
+    }
+
+    // Overrides the number of COW chunks a snapshot may accumulate before
+    // the monitor merges it. Returns false for an unknown snapshot.
+    bool set_snapshot_threshold(const std::string& name, uint64_t chunks) {
+        std::shared_ptr<SnapshotMetadata> snapshot = active_snapshots.find(name);
+        if (!snapshot) {
+            return false;
+        }
+        snapshot->usage_threshold = chunks;
+        if (snapshot->write_counter.load(std::memory_order_relaxed) >= chunks) {
+            queue_merge(name, *snapshot);
+        }
+        return true;
+    }
+
+    // Called from the COW write path (or a DM_DEV_WAIT event handler) for
+    // every batch of chunks copied out. Wakes the monitor as soon as the
+    // snapshot reaches its threshold. Returns false for an unknown snapshot.
+    bool record_cow_writes(const std::string& name, uint64_t chunks) {
+        std::shared_ptr<SnapshotMetadata> snapshot = active_snapshots.find(name);
+        if (!snapshot) {
+            return false;
+        }
+        uint64_t total = snapshot->write_counter.fetch_add(chunks, std::memory_order_relaxed) + chunks;
+        if (total >= snapshot->usage_threshold.load(std::memory_order_relaxed)) {
+            queue_merge(name, *snapshot);
+        }
+        return true;
+    }
+
+    // Records that `origin_chunk` of a snapshot was copied to `cow_chunk`.
+    // Returns false for an unknown snapshot.
+    bool add_exception(const std::string& name, uint64_t origin_chunk, uint64_t cow_chunk) {
+        LatencyHistogram::Scope timing(exception_insert_latency);
+        std::shared_ptr<SnapshotMetadata> snapshot = active_snapshots.find(name);
+        if (!snapshot) {
+            return false;
+        }
+        std::unique_lock<std::shared_mutex> mappings_lock(snapshot->mappings_mutex);
+        snapshot->mappings.insert(origin_chunk, cow_chunk);
+        return true;
+    }
+
+    // COW chunk holding `origin_chunk`, or ExceptionStore::npos when the
+    // chunk is unchanged (or the snapshot unknown) and reads go to the origin.
+    uint64_t resolve_chunk(const std::string& name, uint64_t origin_chunk) const {
+        LatencyHistogram::Scope timing(exception_lookup_latency);
+        std::shared_ptr<SnapshotMetadata> snapshot = active_snapshots.find(name);
+        if (!snapshot) {
+            return ExceptionStore::npos;
+        }
+        std::shared_lock<std::shared_mutex> mappings_lock(snapshot->mappings_mutex);
+        return snapshot->mappings.lookup(origin_chunk);
+    }
+
+    // Streams, in origin order, every chunk range that has an exception in
+    // either snapshot, coalesced per DiffKind. For two snapshots of one
+    // origin with `first` the older, FirstOnly ranges were written between
+    // the two snapshots and changed for certain; Both ranges were written
+    // after `second` was taken and differ only if they were also written in
+    // between, so a replicator compares their COW copies instead of reading
+    // whole devices. Chunks with no exception in either snapshot are
+    // identical and never reported.
+    //
+    // Writers to either store wait while the walk runs; lookups do not.
+    // Returns false if either snapshot is unknown.
+    template<typename Fn>
+    bool diff_snapshots(const std::string& first, const std::string& second, Fn&& fn) {
+        std::shared_ptr<SnapshotMetadata> a = active_snapshots.find(first);
+        std::shared_ptr<SnapshotMetadata> b = active_snapshots.find(second);
+        if (!a || !b) {
+            return false;
+        }
+        if (a == b) {
+            return true;
+        }
+        {
+            std::scoped_lock lock(a->mappings_mutex, b->mappings_mutex);
+            a->mappings.compact();
+            b->mappings.compact();
+        }
+        std::shared_lock<std::shared_mutex> lock_a(a->mappings_mutex, std::defer_lock);
+        std::shared_lock<std::shared_mutex> lock_b(b->mappings_mutex, std::defer_lock);
+        std::lock(lock_a, lock_b);
+
+        bool pending_extent = false;
+        DiffExtent extent{0, 0, DiffKind::Both};
+        auto emit = [&](uint64_t start, uint64_t end, DiffKind kind) {
+            if (pending_extent && extent.kind == kind && extent.origin_chunk + extent.length == start) {
+                extent.length += end - start;
+                return;
+            }
+            if (pending_extent) {
+                fn(extent);
+            }
+            extent = DiffExtent{start, end - start, kind};
+            pending_extent = true;
+        };
+
+        size_t index_a = 0, index_b = 0;
+        ChunkMapping run_a{}, run_b{};
+        bool has_a = a->mappings.next_run(index_a, run_a);
+        bool has_b = b->mappings.next_run(index_b, run_b);
+        while (has_a || has_b) {
+            uint64_t end_a = run_a.origin_chunk + run_a.length;
+            uint64_t end_b = run_b.origin_chunk + run_b.length;
+            if (!has_b || (has_a && end_a <= run_b.origin_chunk)) {
+                emit(run_a.origin_chunk, end_a, DiffKind::FirstOnly);
+                has_a = a->mappings.next_run(index_a, run_a);
+            } else if (!has_a || end_b <= run_a.origin_chunk) {
+                emit(run_b.origin_chunk, end_b, DiffKind::SecondOnly);
+                has_b = b->mappings.next_run(index_b, run_b);
+            } else {
+                // Overlap: emit the part before it, then the shared part,
+                // and keep whatever tail extends past the shared part.
+                if (run_a.origin_chunk < run_b.origin_chunk) {
+                    emit(run_a.origin_chunk, run_b.origin_chunk, DiffKind::FirstOnly);
+                } else if (run_b.origin_chunk < run_a.origin_chunk) {
+                    emit(run_b.origin_chunk, run_a.origin_chunk, DiffKind::SecondOnly);
+                }
+                uint64_t shared_start = std::max(run_a.origin_chunk, run_b.origin_chunk);
+                uint64_t shared_end = std::min(end_a, end_b);
+                emit(shared_start, shared_end, DiffKind::Both);
+
+                run_a.length = end_a - shared_end;
+                run_a.origin_chunk = shared_end;
+                run_b.length = end_b - shared_end;
+                run_b.origin_chunk = shared_end;
+                if (run_a.length == 0) {
+                    has_a = a->mappings.next_run(index_a, run_a);
+                }
+                if (run_b.length == 0) {
+                    has_b = b->mappings.next_run(index_b, run_b);
+                }
+            }
+        }
+        if (pending_extent) {
+            fn(extent);
+        }
+        return true;
+    }
+
+    // Streams every COW chunk of a snapshot from `cow_fd` to `consumer` in
+    // origin order; unchanged chunks are read from the origin instead and
+    // are not part of the export. Returns the bytes exported.
+    uint64_t export_snapshot(const std::string& name, int cow_fd, const ExportConsumer& consumer,
+                             ExportOptions options = {}) {
+        std::shared_ptr<SnapshotMetadata> snapshot = active_snapshots.find(name);
+        if (!snapshot) {
+            throw std::invalid_argument("Unknown snapshot: " + name);
+        }
+        std::vector<ChunkMapping> runs;
+        {
+            std::unique_lock<std::shared_mutex> lock(snapshot->mappings_mutex);
+            snapshot->mappings.for_each_run([&runs](const ChunkMapping& run) {
+                runs.push_back(run);
+            });
+        }
+        options.chunk_bytes = snapshot->chunk_size * 512;
+        SnapshotExporter exporter(options);
+        return exporter.export_runs(cow_fd, runs, consumer);
+    }
+
+    // `sweep` is a fallback full pass for usage that never went through
+    // record_cow_writes(); threshold crossings are handled as they happen.
+    void start_monitoring(std::chrono::milliseconds sweep = std::chrono::seconds(30)) {
+        if (monitoring.exchange(true)) {
+            return;
+        }
+        sweep_interval = sweep;
         monitor_thread = std::thread(&COWSnapshotManager::monitor_cow_usage, this);
     }
 
+    void stop_monitoring() {
+        {
+            std::lock_guard<std::mutex> lock(monitor_mutex);
+            monitoring = false;
+        }
+        monitor_wake.notify_all();
+        if (monitor_thread.joinable()) {
+            monitor_thread.join();
+        }
+    }
+
+    // Caps merge traffic across all snapshots; zero disables a limit.
+    void set_merge_budget(uint64_t bytes_per_second, uint64_t iops) {
+        merges.set_budget(bytes_per_second, iops);
+    }
+
+    std::vector<MergeProgress> merge_progress() const {
+        return merges.progress();
+    }
+
+    struct Metrics {
+        LatencyHistogram::Snapshot create_snapshot;
+        LatencyHistogram::Snapshot add_exception;
+        LatencyHistogram::Snapshot resolve_chunk;
+    };
+
+    Metrics metrics() const {
+        return {create_latency.snapshot(), exception_insert_latency.snapshot(),
+                exception_lookup_latency.snapshot()};
+    }
+
+    // Appends metrics() in the Prometheus text format for a scrape endpoint.
+    void append_metrics(std::string& out, const std::string& prefix = "corestate_snapshot") const {
+        Metrics m = metrics();
+        append_prometheus(out, prefix + "_create_seconds", m.create_snapshot);
+        append_prometheus(out, prefix + "_add_exception_seconds", m.add_exception);
+        append_prometheus(out, prefix + "_resolve_chunk_seconds", m.resolve_chunk);
+    }
+
     void monitor_cow_usage() {
+        std::unique_lock<std::mutex> lock(monitor_mutex);
+        auto next_sweep = std::chrono::steady_clock::now() + sweep_interval;
         while (monitoring) {
-            for (auto& [name, snapshot] : active_snapshots) {
-                uint64_t usage = calculate_cow_usage(snapshot);
-                if (usage > threshold) {
-                    merge_old_chunks(snapshot);
-                }
+            monitor_wake.wait_until(lock, next_sweep, [this] {
+                return !monitoring || !pending_merges.empty();
+            });
+            if (!monitoring) {
+                break;
+            }
+            std::vector<std::string> due;
+            due.swap(pending_merges);
+            bool sweep = std::chrono::steady_clock::now() >= next_sweep;
+            lock.unlock();
+
+            for (const std::string& name : due) {
+                merge_if_over_threshold(name);
+            }
+            if (sweep) {
+                sweep_all_snapshots();
+                next_sweep = std::chrono::steady_clock::now() + sweep_interval;
+            }
+            lock.lock();
+        }
+    }
+
+private:
+    static size_t align_ioctl(size_t bytes) {
+        return (bytes + 7) & ~size_t(7);
+    }
+
+    // Header, one target spec and its NUL-terminated parameter string.
+    static size_t table_ioctl_bytes(size_t params_len) {
+        return sizeof(dm_ioctl) + sizeof(dm_target_spec) + params_len + 1;
+    }
+
+    static dm_ioctl* init_ioctl(char* slot, size_t bytes, const std::string& name, uint32_t flags) {
+        std::memset(slot, 0, bytes);
+        dm_ioctl* io = reinterpret_cast<dm_ioctl*>(slot);
+        io->data_size = static_cast<uint32_t>(bytes);
+        io->data_start = sizeof(dm_ioctl);
+        io->flags = flags;
+        std::strncpy(io->name, name.c_str(), sizeof(io->name) - 1);
+        return io;
+    }
+
+    // Lays out a single-target table load and returns where its
+    // `params_len` + 1 bytes of parameters go.
+    static char* init_table_ioctl(char* slot, const std::string& name, const char* target_type,
+                                  long long sectors, size_t params_len) {
+        dm_ioctl* io = init_ioctl(slot, table_ioctl_bytes(params_len), name, 0);
+        io->target_count = 1;
+        dm_target_spec* tgt = reinterpret_cast<dm_target_spec*>(slot + io->data_start);
+        tgt->sector_start = 0;
+        tgt->length = sectors;
+        std::strncpy(tgt->target_type, target_type, sizeof(tgt->target_type) - 1);
+        return reinterpret_cast<char*>(tgt + 1);
+    }
+
+    // Header-only ioctl on `name`, for cleanup paths that ignore the result.
+    // Built on the stack so it leaves ioctls laid out in the arena intact.
+    void device_ioctl(unsigned long request, const std::string& name) {
+        alignas(dm_ioctl) char buffer[sizeof(dm_ioctl)];
+        init_ioctl(buffer, sizeof(buffer), name, 0);
+        ioctl(dm_fd, request, buffer);
+    }
+
+    std::shared_ptr<SnapshotMetadata> new_metadata(long long origin_size) const {
+        auto snapshot = std::make_shared<SnapshotMetadata>();
+        snapshot->origin_size = origin_size;
+        snapshot->chunk_size = 8; // Sectors, matching the "P 8" snapshot table
+        snapshot->usage_threshold = threshold;
+        return snapshot;
+    }
+
+    // Publishes fresh metadata; re-creating a name replaces the old entry.
+    void register_snapshot(const std::string& name, long long origin_size) {
+        auto snapshot = new_metadata(origin_size);
+        active_snapshots.update([&](SnapshotRegistry::Map& map) {
+            map[name] = std::move(snapshot);
+        });
+    }
+
+    void merge_if_over_threshold(const std::string& name) {
+        std::shared_ptr<SnapshotMetadata> found = active_snapshots.find(name);
+        if (!found) {
+            return;
+        }
+        SnapshotMetadata& snapshot = *found;
+        // Cleared first so writes arriving during the merge queue it again.
+        snapshot.merge_queued.store(false, std::memory_order_release);
+        uint64_t limit = snapshot.usage_threshold.load(std::memory_order_relaxed);
+        uint64_t written = snapshot.write_counter.load(std::memory_order_relaxed);
+        uint64_t usage = calculate_cow_usage(snapshot);
+        if (written < limit && usage <= limit) {
+            return;
+        }
+        merges.schedule(name, std::max(written, usage), snapshot.chunk_size * 512);
+        uint64_t remaining = snapshot.write_counter.fetch_sub(written, std::memory_order_relaxed) - written;
+        if (remaining >= limit) {
+            queue_merge(name, snapshot);
+        }
+    }
+
+    void sweep_all_snapshots() {
+        std::shared_ptr<const SnapshotRegistry::Map> map = active_snapshots.snapshot();
+        for (const auto& [name, snapshot] : *map) {
+            uint64_t usage = calculate_cow_usage(*snapshot);
+            if (usage > snapshot->usage_threshold.load(std::memory_order_relaxed)) {
+                merges.schedule(name, usage, snapshot->chunk_size * 512);
             }
-            std::this_thread::sleep_for(std::chrono::seconds(30));
         }
     }
 };
\ No newline at end of file
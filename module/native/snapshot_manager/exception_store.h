@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// --- Exception Store ---
+
+// A run of consecutive origin chunks stored at consecutive COW chunks.
+struct ChunkMapping {
+    uint64_t origin_chunk;
+    uint64_t cow_chunk;
+    uint64_t length;
+};
+
+// Origin chunk -> COW chunk map for one snapshot.
+//
+// Mappings live in a sorted array of 8-byte run entries, (origin << 32 | cow),
+// where each run covers origin chunks up to the next entry's start and a cow
+// of `hole` marks a gap with no exception. Consecutive chunks copied to
+// consecutive COW chunks, the common case for sequential writes, collapse
+// into one entry. A directory with one slot per 2^shift origin chunks, sized
+// to about one slot per run, narrows each lookup to a handful of entries.
+//
+// New exceptions go into a small sorted pending array that lookups check
+// first. It is merged into the runs once it fills, so inserts cost
+// O(runs / pending_limit) amortized and the run array stays compact.
+//
+// Chunk numbers are limited to 32 bits (16 TiB at 4 KiB chunks). Not
+// thread-safe; callers lock.
+class ExceptionStore {
+public:
+    static constexpr uint64_t npos = UINT64_MAX;
+    static constexpr uint64_t max_chunk = UINT32_MAX - 1;
+
+    explicit ExceptionStore(size_t pending_limit = 1024)
+        : pending_limit(std::max<size_t>(1, pending_limit)), runs{pack(0, hole)}, directory{0} {}
+
+    // Records that `origin_chunk` now lives at `cow_chunk`, replacing any
+    // earlier mapping.
+    void insert(uint64_t origin_chunk, uint64_t cow_chunk) {
+        if (origin_chunk > max_chunk || cow_chunk > max_chunk) {
+            throw std::out_of_range("Chunk number exceeds exception store range");
+        }
+        uint64_t entry = pack(static_cast<uint32_t>(origin_chunk), static_cast<uint32_t>(cow_chunk));
+        auto it = std::lower_bound(pending.begin(), pending.end(), pack(static_cast<uint32_t>(origin_chunk), 0));
+        if (it != pending.end() && origin_of(*it) == origin_chunk) {
+            *it = entry;
+        } else {
+            pending.insert(it, entry);
+        }
+        if (pending.size() >= pending_limit) {
+            compact();
+        }
+    }
+
+    // COW chunk holding `origin_chunk`, or npos if it has no exception.
+    uint64_t lookup(uint64_t origin_chunk) const {
+        if (origin_chunk > max_chunk) {
+            return npos;
+        }
+        uint32_t origin = static_cast<uint32_t>(origin_chunk);
+        if (!pending.empty()) {
+            auto it = std::lower_bound(pending.begin(), pending.end(), pack(origin, 0));
+            if (it != pending.end() && origin_of(*it) == origin) {
+                return cow_of(*it);
+            }
+        }
+
+        size_t slot = std::min<size_t>(uint64_t(origin) >> shift, directory.size() - 1);
+        size_t lo = directory[slot];
+        size_t hi = slot + 1 < directory.size() ? directory[slot + 1] + 1 : runs.size();
+        size_t run = std::upper_bound(runs.begin() + lo, runs.begin() + hi, pack(origin, hole)) - runs.begin() - 1;
+        uint32_t cow = cow_of(runs[run]);
+        return cow == hole ? npos : uint64_t(cow) + (origin - origin_of(runs[run]));
+    }
+
+    // Merges pending exceptions into the run array and rebuilds the directory.
+    void compact() {
+        if (pending.empty()) {
+            return;
+        }
+        std::vector<uint64_t> merged;
+        merged.reserve(runs.size() + 2 * pending.size());
+        size_t next = 0;
+        for (size_t i = 0; i < runs.size(); ++i) {
+            uint64_t start = origin_of(runs[i]);
+            uint64_t end = i + 1 < runs.size() ? origin_of(runs[i + 1]) : uint64_t(UINT32_MAX) + 1;
+            uint32_t cow = cow_of(runs[i]);
+            uint64_t pos = start;
+            for (; next < pending.size() && origin_of(pending[next]) < end; ++next) {
+                uint32_t origin = origin_of(pending[next]);
+                if (pos < origin) {
+                    append_run(merged, static_cast<uint32_t>(pos), shifted(cow, pos - start));
+                }
+                append_run(merged, origin, cow_of(pending[next]));
+                pos = uint64_t(origin) + 1;
+            }
+            if (pos < end) {
+                append_run(merged, static_cast<uint32_t>(pos), shifted(cow, pos - start));
+            }
+        }
+        runs.swap(merged);
+        pending.clear();
+        rebuild_directory();
+    }
+
+    // Visits every mapped run in origin order. Compacts first.
+    template<typename Fn>
+    void for_each_run(Fn&& fn) {
+        compact();
+        size_t index = 0;
+        ChunkMapping run;
+        while (next_run(index, run)) {
+            fn(run);
+        }
+    }
+
+    // Cursor form of for_each_run for walking several stores in step:
+    // fills `out` with the next mapped run at or after run `index`, advances
+    // `index` past it and returns false at the end. Pending exceptions are
+    // not visited, so compact() first.
+    bool next_run(size_t& index, ChunkMapping& out) const {
+        for (; index + 1 < runs.size(); ++index) {
+            uint32_t cow = cow_of(runs[index]);
+            if (cow != hole) {
+                uint64_t origin = origin_of(runs[index]);
+                out = ChunkMapping{origin, cow, origin_of(runs[index + 1]) - origin};
+                ++index;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t run_count() const { return runs.size() + pending.size(); }
+
+    size_t memory_bytes() const {
+        return (runs.capacity() + pending.capacity()) * sizeof(uint64_t) + directory.capacity() * sizeof(uint32_t);
+    }
+
+private:
+    static constexpr uint32_t hole = UINT32_MAX;
+
+    static uint64_t pack(uint32_t origin, uint32_t cow) { return uint64_t(origin) << 32 | cow; }
+    static uint32_t origin_of(uint64_t entry) { return static_cast<uint32_t>(entry >> 32); }
+    static uint32_t cow_of(uint64_t entry) { return static_cast<uint32_t>(entry); }
+
+    static uint32_t shifted(uint32_t cow, uint64_t offset) {
+        return cow == hole ? hole : static_cast<uint32_t>(cow + offset);
+    }
+
+    // Appends a run starting at `origin`, or extends the last one when it
+    // continues the same hole or the same contiguous COW stretch.
+    static void append_run(std::vector<uint64_t>& out, uint32_t origin, uint32_t cow) {
+        if (!out.empty()) {
+            uint32_t last_origin = origin_of(out.back());
+            uint32_t last_cow = cow_of(out.back());
+            if (last_cow == hole ? cow == hole
+                                 : cow != hole && uint64_t(cow) - last_cow == uint64_t(origin) - last_origin) {
+                return;
+            }
+        }
+        out.push_back(pack(origin, cow));
+    }
+
+    void rebuild_directory() {
+        // The final run is the open-ended hole; size slots to the mapped span.
+        uint64_t span = uint64_t(origin_of(runs.back())) + 1;
+        shift = 0;
+        while ((span >> shift) > runs.size()) {
+            ++shift;
+        }
+        directory.assign((span >> shift) + 1, 0);
+        size_t run = 0;
+        for (size_t slot = 0; slot < directory.size(); ++slot) {
+            uint64_t slot_start = uint64_t(slot) << shift;
+            while (run + 1 < runs.size() && origin_of(runs[run + 1]) <= slot_start) {
+                ++run;
+            }
+            directory[slot] = static_cast<uint32_t>(run);
+        }
+    }
+
+    size_t pending_limit;
+    std::vector<uint64_t> runs;       // Sorted by origin, starts at origin 0, ends with a hole
+    std::vector<uint64_t> pending;    // Sorted single-chunk exceptions not yet merged
+    std::vector<uint32_t> directory;  // Last run starting at or before slot << shift
+    unsigned shift = 32;
+};
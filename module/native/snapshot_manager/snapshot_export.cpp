@@ -0,0 +1,442 @@
+#include "snapshot_export.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define CORESTATE_HAVE_IO_URING 1
+#endif
+
+namespace {
+
+[[noreturn]] void throw_read_error(int error, uint64_t offset) {
+    throw std::runtime_error("Snapshot export read failed at offset " + std::to_string(offset) + ": " +
+                             (error ? std::strerror(error) : "unexpected end of device"));
+}
+
+} // namespace
+
+// Splits exception runs into reads of at most `chunks_per_io` chunks.
+class SnapshotExporter::RequestCursor {
+public:
+    RequestCursor(const std::vector<ChunkMapping>& runs, uint64_t chunk_bytes, uint64_t chunks_per_io)
+        : runs(runs), chunk_bytes(chunk_bytes), chunks_per_io(chunks_per_io) {}
+
+    bool next(Request& out) {
+        while (run < runs.size() && consumed >= runs[run].length) {
+            ++run;
+            consumed = 0;
+        }
+        if (run == runs.size()) {
+            return false;
+        }
+        const ChunkMapping& mapping = runs[run];
+        uint64_t chunks = std::min(chunks_per_io, mapping.length - consumed);
+        out.origin_chunk = mapping.origin_chunk + consumed;
+        out.offset = (mapping.cow_chunk + consumed) * chunk_bytes;
+        out.bytes = static_cast<size_t>(chunks * chunk_bytes);
+        consumed += chunks;
+        return true;
+    }
+
+private:
+    const std::vector<ChunkMapping>& runs;
+    const uint64_t chunk_bytes;
+    const uint64_t chunks_per_io;
+    size_t run = 0;
+    uint64_t consumed = 0; // Chunks of runs[run] already handed out
+};
+
+// --- io_uring ---
+
+#ifdef CORESTATE_HAVE_IO_URING
+
+// Minimal io_uring driver over the raw syscalls, so the export path needs
+// no liburing. One submission queue entry per slot; the slot buffers are
+// registered once so reads use IORING_OP_READ_FIXED.
+class SnapshotExporter::Ring {
+public:
+    // Returns nullptr when the kernel (or a seccomp policy) refuses io_uring.
+    static std::unique_ptr<Ring> create(unsigned entries, char* buffers, size_t slot_bytes) {
+        std::unique_ptr<Ring> ring(new Ring());
+        if (!ring->setup(entries, buffers, slot_bytes)) {
+            return nullptr;
+        }
+        return ring;
+    }
+
+    ~Ring() {
+        if (sqes) munmap(sqes, sqes_bytes);
+        if (cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_bytes);
+        if (sq_ptr) munmap(sq_ptr, sq_bytes);
+        if (fd >= 0) close(fd);
+    }
+
+    void queue_read(int file, unsigned slot, char* dest, size_t bytes, uint64_t offset) {
+        unsigned tail = *sq_tail;
+        unsigned index = tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->fd = file;
+        sqe->addr = reinterpret_cast<uint64_t>(dest);
+        sqe->len = static_cast<uint32_t>(bytes);
+        sqe->off = offset;
+        sqe->buf_index = static_cast<uint16_t>(slot);
+        sqe->user_data = slot;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++unsubmitted;
+    }
+
+    // Submits queued reads and, if `wait`, blocks for at least one completion.
+    void submit(bool wait) {
+        while (unsubmitted || wait) {
+            unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+            long ret = syscall(__NR_io_uring_enter, fd, unsubmitted, wait ? 1 : 0, flags, nullptr, 0);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+            }
+            unsubmitted -= static_cast<unsigned>(ret);
+            wait = false;
+        }
+    }
+
+    // Calls fn(slot, result) for every available completion.
+    template<typename Fn>
+    void reap(Fn&& fn) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = cqes[head & cq_mask];
+            fn(static_cast<unsigned>(cqe.user_data), cqe.res);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+private:
+    Ring() = default;
+
+    bool setup(unsigned entries, char* buffers, size_t slot_bytes) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) {
+            return false;
+        }
+
+        sq_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_bytes = cq_bytes = std::max(sq_bytes, cq_bytes);
+        }
+        sq_ptr = map(sq_bytes, IORING_OFF_SQ_RING);
+        cq_ptr = single_mmap ? sq_ptr : map(cq_bytes, IORING_OFF_CQ_RING);
+        sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(map(sqes_bytes, IORING_OFF_SQES));
+        if (!sq_ptr || !cq_ptr || !sqes) {
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sq_ptr);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        std::vector<iovec> iovecs(entries);
+        for (unsigned i = 0; i < entries; ++i) {
+            iovecs[i].iov_base = buffers + i * slot_bytes;
+            iovecs[i].iov_len = slot_bytes;
+        }
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iovecs.data(), entries) == 0;
+    }
+
+    void* map(size_t bytes, uint64_t offset) {
+        void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    int fd = -1;
+    void* sq_ptr = nullptr;
+    void* cq_ptr = nullptr;
+    size_t sq_bytes = 0;
+    size_t cq_bytes = 0;
+    size_t sqes_bytes = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+    unsigned unsubmitted = 0;
+};
+
+#else
+
+// Stub so builds without io_uring headers always take the pread path.
+class SnapshotExporter::Ring {
+public:
+    static std::unique_ptr<Ring> create(unsigned, char*, size_t) { return nullptr; }
+    void queue_read(int, unsigned, char*, size_t, uint64_t) {}
+    void submit(bool) {}
+    template<typename Fn>
+    void reap(Fn&&) {}
+};
+
+#endif
+
+// --- Snapshot Exporter ---
+
+SnapshotExporter::SnapshotExporter(const ExportOptions& opts) : options(opts) {
+    if (options.chunk_bytes == 0 || options.queue_depth == 0) {
+        throw std::invalid_argument("Export chunk size and queue depth must be non-zero");
+    }
+    uint64_t chunks_per_io = std::max<uint64_t>(1, options.io_bytes / options.chunk_bytes);
+    // Page-aligned slots keep the buffers usable with O_DIRECT descriptors.
+    slot_bytes = static_cast<size_t>((chunks_per_io * options.chunk_bytes + 4095) & ~uint64_t(4095));
+
+    void* memory = nullptr;
+    if (posix_memalign(&memory, 4096, slot_bytes * options.queue_depth) != 0) {
+        throw std::runtime_error("Failed to allocate snapshot export buffers");
+    }
+    buffers = static_cast<char*>(memory);
+    slots.resize(options.queue_depth);
+
+    if (options.use_io_uring) {
+        ring = Ring::create(options.queue_depth, buffers, slot_bytes);
+    }
+}
+
+SnapshotExporter::~SnapshotExporter() {
+    ring.reset(); // Unregisters the buffers before they are freed
+    std::free(buffers);
+}
+
+uint64_t SnapshotExporter::export_runs(int fd, const std::vector<ChunkMapping>& runs,
+                                       const ExportConsumer& consumer) {
+    RequestCursor cursor(runs, options.chunk_bytes,
+                         std::max<uint64_t>(1, options.io_bytes / options.chunk_bytes));
+    return ring ? export_with_ring(fd, cursor, consumer) : export_with_threads(fd, cursor, consumer);
+}
+
+uint64_t SnapshotExporter::export_with_ring(int fd, RequestCursor& cursor, const ExportConsumer& consumer) {
+    const size_t depth = slots.size();
+    uint64_t submitted = 0;
+    uint64_t delivered = 0;
+    uint64_t delivered_bytes = 0;
+    size_t inflight = 0;
+    bool more = true;
+    int error = 0;
+    uint64_t error_offset = 0;
+    bool failed = false;
+
+    auto complete = [&](unsigned slot_index, int result) {
+        Slot& slot = slots[slot_index];
+        --inflight;
+        if (result <= 0) {
+            if (!failed) {
+                failed = true;
+                error = -result;
+                error_offset = slot.request.offset + slot.filled;
+            }
+            return;
+        }
+        slot.filled += static_cast<size_t>(result);
+        if (slot.filled < slot.request.bytes && !failed) {
+            // Short read: queue the remainder into the same buffer.
+            ring->queue_read(fd, slot_index, buffer(slot_index) + slot.filled, slot.request.bytes - slot.filled,
+                             slot.request.offset + slot.filled);
+            ++inflight;
+            return;
+        }
+        slot.done = slot.filled == slot.request.bytes;
+    };
+
+    // The kernel may still be writing into the buffers; never leave early.
+    auto drain = [&] {
+        while (inflight) {
+            ring->submit(true);
+            ring->reap(complete);
+        }
+    };
+
+    try {
+        while (!failed) {
+            while (more && submitted - delivered < depth) {
+                unsigned slot_index = static_cast<unsigned>(submitted % depth);
+                Slot& slot = slots[slot_index];
+                if (!cursor.next(slot.request)) {
+                    more = false;
+                    break;
+                }
+                slot.filled = 0;
+                slot.done = false;
+                ring->queue_read(fd, slot_index, buffer(slot_index), slot.request.bytes, slot.request.offset);
+                ++submitted;
+                ++inflight;
+            }
+
+            bool progressed = false;
+            while (delivered < submitted && slots[delivered % depth].done) {
+                size_t slot_index = delivered % depth;
+                const Slot& slot = slots[slot_index];
+                consumer(slot.request.origin_chunk, buffer(slot_index), slot.request.bytes);
+                delivered_bytes += slot.request.bytes;
+                ++delivered;
+                progressed = true;
+            }
+            if (!more && delivered == submitted) {
+                break;
+            }
+            if (!progressed) {
+                ring->submit(true);
+                ring->reap(complete);
+            }
+        }
+    } catch (...) {
+        drain();
+        throw;
+    }
+
+    drain();
+    if (failed) {
+        throw_read_error(error, error_offset);
+    }
+    return delivered_bytes;
+}
+
+uint64_t SnapshotExporter::export_with_threads(int fd, RequestCursor& cursor, const ExportConsumer& consumer) {
+    const size_t depth = slots.size();
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable slot_ready;
+    uint64_t claimed = 0;
+    uint64_t delivered = 0;
+    bool more = true;
+    bool stopping = false;
+    bool failed = false;
+    int error = 0;
+    uint64_t error_offset = 0;
+
+    auto worker = [&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            work_ready.wait(lock, [&] { return stopping || !more || claimed - delivered < depth; });
+            if (stopping || !more) {
+                return;
+            }
+            size_t slot_index = claimed % depth;
+            Slot& slot = slots[slot_index];
+            if (!cursor.next(slot.request)) {
+                more = false;
+                work_ready.notify_all();
+                slot_ready.notify_all();
+                return;
+            }
+            slot.filled = 0;
+            slot.done = false;
+            ++claimed;
+            lock.unlock();
+
+            int read_error = 0;
+            char* dest = buffer(slot_index);
+            while (slot.filled < slot.request.bytes) {
+                ssize_t n = pread(fd, dest + slot.filled, slot.request.bytes - slot.filled,
+                                  static_cast<off_t>(slot.request.offset + slot.filled));
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    read_error = n < 0 ? errno : 0;
+                    break;
+                }
+                slot.filled += static_cast<size_t>(n);
+            }
+
+            lock.lock();
+            if (slot.filled < slot.request.bytes) {
+                if (!failed) {
+                    failed = true;
+                    error = read_error;
+                    error_offset = slot.request.offset + slot.filled;
+                }
+                stopping = true;
+                work_ready.notify_all();
+            } else {
+                slot.done = true;
+            }
+            slot_ready.notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    size_t threads = std::max<size_t>(1, std::min(options.fallback_threads, depth));
+    for (size_t i = 0; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+
+    auto stop = [&] {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        for (auto& thread : pool) {
+            thread.join();
+        }
+    };
+
+    uint64_t delivered_bytes = 0;
+    try {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            slot_ready.wait(lock, [&] {
+                return failed || (delivered < claimed && slots[delivered % depth].done) ||
+                       (!more && delivered == claimed);
+            });
+            if (failed || delivered == claimed) {
+                break;
+            }
+            size_t slot_index = delivered % depth;
+            const Slot& slot = slots[slot_index];
+            lock.unlock();
+            consumer(slot.request.origin_chunk, buffer(slot_index), slot.request.bytes);
+            lock.lock();
+            delivered_bytes += slot.request.bytes;
+            ++delivered;
+            work_ready.notify_one();
+        }
+    } catch (...) {
+        stop();
+        throw;
+    }
+
+    stop();
+    if (failed) {
+        throw_read_error(error, error_offset);
+    }
+    return delivered_bytes;
+}
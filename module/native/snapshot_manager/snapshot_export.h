@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "exception_store.h"
+
+// --- Snapshot Export ---
+
+struct ExportOptions {
+    uint64_t chunk_bytes = 4096;
+    size_t io_bytes = 256 * 1024; // Largest single read; runs are split to fit
+    unsigned queue_depth = 32;    // Reads in flight
+    size_t fallback_threads = 4;  // pread workers when io_uring is unavailable
+    bool use_io_uring = true;
+};
+
+// Receives `bytes` of snapshot data for consecutive origin chunks starting at
+// `origin_chunk`. `data` points into the exporter's I/O buffers and is only
+// valid for the duration of the call.
+using ExportConsumer = std::function<void(uint64_t origin_chunk, const void* data, size_t bytes)>;
+
+// Reads the COW chunks behind a snapshot's exception runs and streams them
+// to a consumer in mapping (origin) order. Up to queue_depth reads are kept
+// in flight against the COW device, each landing directly in one of a fixed
+// set of page-aligned buffers; completions are delivered strictly in order
+// and their buffer recycled, so data is never copied on the way to the
+// consumer. io_uring with registered buffers is used when the kernel allows
+// it, otherwise a small pread thread pool fills the same buffers.
+class SnapshotExporter {
+public:
+    explicit SnapshotExporter(const ExportOptions& options = {});
+    ~SnapshotExporter();
+
+    SnapshotExporter(const SnapshotExporter&) = delete;
+    SnapshotExporter& operator=(const SnapshotExporter&) = delete;
+
+    // Exports `runs` (sorted by origin chunk) from `fd` and returns the bytes
+    // delivered. Throws std::runtime_error on a read error or short device.
+    uint64_t export_runs(int fd, const std::vector<ChunkMapping>& runs, const ExportConsumer& consumer);
+
+    bool uses_io_uring() const { return ring != nullptr; }
+
+private:
+    struct Request {
+        uint64_t origin_chunk;
+        uint64_t offset; // Byte offset on the COW device
+        size_t bytes;
+    };
+
+    struct Slot {
+        Request request;
+        size_t filled;
+        bool done;
+    };
+
+    class RequestCursor;
+    class Ring;
+
+    char* buffer(size_t slot) const { return buffers + slot * slot_bytes; }
+
+    uint64_t export_with_ring(int fd, RequestCursor& cursor, const ExportConsumer& consumer);
+    uint64_t export_with_threads(int fd, RequestCursor& cursor, const ExportConsumer& consumer);
+
+    ExportOptions options;
+    size_t slot_bytes;
+    char* buffers = nullptr;
+    std::vector<Slot> slots;
+    std::unique_ptr<Ring> ring;
+};